@@ -0,0 +1,352 @@
+#ifndef BLOCK_STORAGE_H
+#define BLOCK_STORAGE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+/**
+ * The BlockStorage class holds the block ids of one chunk column, including
+ * its one block halo, split into vertical sections. A section containing a
+ * single block id stores only that id. Any other section stores a palette of
+ * the ids it contains and packs an index into that palette for every block
+ * using 1, 2, 4 or 8 bits, so all 256 ids remain available.
+ */
+class BlockStorage {
+public:
+    static constexpr int WIDTH = 18;
+    static constexpr int HEIGHT = 256;
+    static constexpr int SECTION_HEIGHT = 16;
+    static constexpr int SECTION_COUNT = HEIGHT / SECTION_HEIGHT;
+    static constexpr int SECTION_VOLUME = WIDTH * WIDTH * SECTION_HEIGHT;
+
+private:
+    struct Section {
+        uint8_t uniform = 0;
+        uint8_t bits = 0;
+        std::vector<uint8_t> palette;
+        std::vector<uint64_t> data;
+
+        uint8_t get(int i) const {
+            if (bits == 0) return uniform;
+            const size_t bit = (size_t) i * bits;
+            const uint64_t mask = (uint64_t(1) << bits) - 1;
+            return palette[(data[bit >> 6] >> (bit & 63)) & mask];
+        }
+
+        /**
+         * Returns true if every packed index refers to an entry of the
+         * palette. Every other index is masked out so that each keeps an
+         * empty field above it, and adding 2^bits - palette size to each of
+         * the rest carries into that field exactly when it is out of range.
+         */
+        bool indicesInPalette() const {
+            if (palette.size() == (size_t(1) << bits)) return true;
+            uint64_t fields = 0, bias = 0, carries = 0;
+            for (int shift = 0; shift < 64; shift += 2 * bits) {
+                fields |= ((uint64_t(1) << bits) - 1) << shift;
+                bias |= ((uint64_t(1) << bits) - palette.size()) << shift;
+                carries |= uint64_t(1) << (shift + bits);
+            }
+            uint64_t sums = 0;
+            for (uint64_t word: data) {
+                sums |= ((word & fields) + bias) | (((word >> bits) & fields) + bias);
+            }
+            return (sums & carries) == 0;
+        }
+
+        void setIndex(int i, uint8_t index) {
+            const size_t bit = (size_t) i * bits;
+            const uint64_t mask = (uint64_t(1) << bits) - 1;
+            uint64_t &word = data[bit >> 6];
+            word = (word & ~(mask << (bit & 63))) | (uint64_t(index) << (bit & 63));
+        }
+
+        /**
+         * Returns the palette index of the given block, adding it to the
+         * palette and widening the packed indices if necessary.
+         */
+        uint8_t indexOf(uint8_t block) {
+            if (bits == 0) {
+                palette.assign(1, uniform);
+                bits = 1;
+                data.assign(SECTION_VOLUME / 64, 0);
+            }
+            auto it = std::find(palette.begin(), palette.end(), block);
+            if (it != palette.end()) return it - palette.begin();
+            if (palette.size() == (size_t(1) << bits)) repack(bits * 2);
+            palette.push_back(block);
+            return palette.size() - 1;
+        }
+
+        void repack(int new_bits) {
+            Section section;
+            section.bits = new_bits;
+            section.palette = palette;
+            section.data.assign(SECTION_VOLUME * new_bits / 64, 0);
+            const uint64_t mask = (uint64_t(1) << bits) - 1;
+            for (int i = 0; i < SECTION_VOLUME; i++) {
+                const size_t bit = (size_t) i * bits;
+                section.setIndex(i, (data[bit >> 6] >> (bit & 63)) & mask);
+            }
+            *this = std::move(section);
+        }
+
+        void fill(uint8_t block) {
+            uniform = block;
+            bits = 0;
+            palette = std::vector<uint8_t>();
+            data = std::vector<uint64_t>();
+        }
+    };
+
+    Section sections_[SECTION_COUNT];
+
+    static int index(int x, int y, int z) {
+        return ((z % SECTION_HEIGHT) * WIDTH + y) * WIDTH + x;
+    }
+
+public:
+
+    uint8_t get(int x, int y, int z) const {
+        return sections_[z / SECTION_HEIGHT].get(index(x, y, z));
+    }
+
+    void set(int x, int y, int z, uint8_t block) {
+        Section &section = sections_[z / SECTION_HEIGHT];
+        if (section.bits == 0 && section.uniform == block) return;
+        section.setIndex(index(x, y, z), section.indexOf(block));
+    }
+
+    /**
+     * Sets the blocks from z0 up to and including z1 in the given column,
+     * ignoring any part of the range outside the column.
+     */
+    void fillColumn(int x, int y, int z0, int z1, uint8_t block) {
+        z1 = std::min(z1, HEIGHT - 1);
+        for (int z = std::max(z0, 0); z <= z1;) {
+            Section &section = sections_[z / SECTION_HEIGHT];
+            const int end = std::min(z1, (z / SECTION_HEIGHT + 1) * SECTION_HEIGHT - 1);
+            if (section.bits != 0 || section.uniform != block) {
+                const uint8_t i = section.indexOf(block);
+                for (int k = z; k <= end; k++) section.setIndex(index(x, y, k), i);
+            }
+            z = end + 1;
+        }
+    }
+
+    /**
+     * Sets every block of the given section.
+     */
+    void fillSection(int section, uint8_t block) {
+        sections_[section].fill(block);
+    }
+
+    /**
+     * Empty sections hold only air. Full sections hold no air at all, and
+     * Mixed sections may hold both.
+     */
+    enum class Occupancy {
+        Empty,
+        Full,
+        Mixed
+    };
+
+    /**
+     * Returns the occupancy of the given section, with block id 0 taken as
+     * air. Sections are only known to be Full or Empty after being filled or
+     * compacted.
+     */
+    Occupancy occupancy(int section) const {
+        const Section &s = sections_[section];
+        if (s.bits == 0) return s.uniform == 0 ? Occupancy::Empty : Occupancy::Full;
+        if (std::find(s.palette.begin(), s.palette.end(), 0) != s.palette.end()) return Occupancy::Mixed;
+        return Occupancy::Full;
+    }
+
+    /**
+     * Returns the height of the highest block other than air in the given
+     * column, or -1 if the column holds only air.
+     */
+    int top(int x, int y) const {
+        for (int s = SECTION_COUNT - 1; s >= 0; s--) {
+            const Section &section = sections_[s];
+            if (section.bits == 0) {
+                if (section.uniform != 0) return s * SECTION_HEIGHT + SECTION_HEIGHT - 1;
+                continue;
+            }
+            for (int z = s * SECTION_HEIGHT + SECTION_HEIGHT - 1; z >= s * SECTION_HEIGHT; z--) {
+                if (section.get(index(x, y, z)) != 0) return z;
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * Returns true if every block in the given section has the same id.
+     * Sections are only known to be uniform after being filled or compacted.
+     */
+    bool isUniform(int section) const {
+        return sections_[section].bits == 0;
+    }
+
+    /**
+     * Returns the id of every block in a uniform section.
+     */
+    uint8_t uniformBlock(int section) const {
+        return sections_[section].uniform;
+    }
+
+    /**
+     * Drops unused palette entries, narrows the packed indices to the fewest
+     * bits that fit and turns single id sections back into uniform ones.
+     */
+    void compact() {
+        for (Section &section: sections_) {
+            if (section.bits == 0) continue;
+
+            std::vector<int> count(section.palette.size());
+            std::vector<uint8_t> index(SECTION_VOLUME);
+            const uint64_t mask = (uint64_t(1) << section.bits) - 1;
+            for (int i = 0; i < SECTION_VOLUME; i++) {
+                const size_t bit = (size_t) i * section.bits;
+                index[i] = (section.data[bit >> 6] >> (bit & 63)) & mask;
+                count[index[i]]++;
+            }
+
+            std::vector<uint8_t> palette;
+            std::vector<uint8_t> remap(section.palette.size());
+            for (size_t i = 0; i < section.palette.size(); i++) {
+                if (count[i] == 0) continue;
+                remap[i] = palette.size();
+                palette.push_back(section.palette[i]);
+            }
+
+            if (palette.size() == 1) {
+                section.fill(palette[0]);
+                continue;
+            }
+
+            int bits = 1;
+            while ((size_t(1) << bits) < palette.size()) bits *= 2;
+            if (bits == section.bits && palette.size() == section.palette.size()) continue;
+
+            section.bits = bits;
+            section.palette = palette;
+            section.data.assign(SECTION_VOLUME * bits / 64, 0);
+            section.data.shrink_to_fit();
+            for (int i = 0; i < SECTION_VOLUME; i++) {
+                section.setIndex(i, remap[index[i]]);
+            }
+        }
+    }
+
+    /**
+     * Decodes the blocks of sections first up to but excluding last into a
+     * dense array laid out as [x][y][z], leaving other heights untouched.
+     */
+    void unpack(uint8_t (&out)[WIDTH][WIDTH][HEIGHT], int first = 0, int last = SECTION_COUNT) const {
+        for (int s = std::max(first, 0); s < std::min(last, SECTION_COUNT); s++) {
+            const Section &section = sections_[s];
+            for (int x = 0; x < WIDTH; x++) {
+                for (int y = 0; y < WIDTH; y++) {
+                    uint8_t *column = &out[x][y][s * SECTION_HEIGHT];
+                    if (section.bits == 0) {
+                        std::fill_n(column, SECTION_HEIGHT, section.uniform);
+                        continue;
+                    }
+                    for (int z = 0; z < SECTION_HEIGHT; z++) {
+                        column[z] = section.get(index(x, y, z));
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * Appends the sections to the given bytes. A uniform section takes two
+     * bytes and any other its palette followed by its packed indices, in host
+     * byte order.
+     */
+    void serialize(std::vector<uint8_t> &out) const {
+        for (const Section &section: sections_) {
+            out.push_back(section.bits);
+            if (section.bits == 0) {
+                out.push_back(section.uniform);
+                continue;
+            }
+            out.push_back(section.palette.size() - 1);
+            out.insert(out.end(), section.palette.begin(), section.palette.end());
+            const uint8_t *words = (const uint8_t*) section.data.data();
+            out.insert(out.end(), words, words + section.data.size() * sizeof(uint64_t));
+        }
+    }
+
+    /**
+     * Replaces the sections with those written by serialize. Returns false,
+     * leaving this storage unchanged, if the bytes are malformed.
+     */
+    bool deserialize(const uint8_t *data, size_t size) {
+        Section sections[SECTION_COUNT];
+        const uint8_t *end = data + size;
+        for (Section &section: sections) {
+            if (end - data < 2) return false;
+            section.bits = *data++;
+            if (section.bits == 0) {
+                section.uniform = *data++;
+                continue;
+            }
+            if (section.bits != 1 && section.bits != 2 && section.bits != 4 && section.bits != 8) return false;
+            const size_t palette = (size_t) *data++ + 1;
+            const size_t words = SECTION_VOLUME * section.bits / 64;
+            if (palette > (size_t(1) << section.bits) || (size_t) (end - data) < palette + words * sizeof(uint64_t)) return false;
+            section.palette.assign(data, data + palette);
+            data += palette;
+            section.data.resize(words);
+            std::copy(data, data + words * sizeof(uint64_t), (uint8_t*) section.data.data());
+            data += words * sizeof(uint64_t);
+            if (!section.indicesInPalette()) return false;
+        }
+        if (data != end) return false;
+        for (int s = 0; s < SECTION_COUNT; s++) {
+            sections_[s] = std::move(sections[s]);
+        }
+        return true;
+    }
+
+    /**
+     * Returns a hash of the blocks in the sections from first up to but not
+     * including last, so that what is built from them can be cached by
+     * content. The same blocks packed differently may hash differently.
+     */
+    uint64_t hash(int first = 0, int last = SECTION_COUNT) const {
+        uint64_t h = 0xcbf29ce484222325ull;
+        auto add = [&h](uint64_t x) {
+            h ^= x * 0x9e3779b97f4a7c15ull;
+            h = (h << 31 | h >> 33) * 0xbf58476d1ce4e5b9ull;
+        };
+        for (int s = std::max(first, 0); s < std::min(last, SECTION_COUNT); s++) {
+            const Section &section = sections_[s];
+            add((uint64_t) s << 16 | section.bits << 8 | (section.bits == 0 ? section.uniform : 0));
+            for (uint8_t block: section.palette) add(block);
+            for (uint64_t word: section.data) add(word);
+        }
+        return h ^ (h >> 29);
+    }
+
+    /**
+     * Returns the number of bytes used by this storage, including its
+     * palettes and packed indices.
+     */
+    size_t memoryUsage() const {
+        size_t bytes = sizeof(*this);
+        for (const Section &section: sections_) {
+            bytes += section.palette.capacity();
+            bytes += section.data.capacity() * sizeof(uint64_t);
+        }
+        return bytes;
+    }
+};
+
+#endif /* BLOCK_STORAGE_H */
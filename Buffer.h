@@ -2,29 +2,27 @@
 #define BUFFER_H
 
 #include "ShaderTypes.h"
+#include <cassert>
+#include <cstring>
+#include <memory>
 #include <vector>
+#ifdef __OBJC__
 #include <Metal/Metal.h>
+#endif
 
 /**
  * The Buffer class is a cross platform dynamically sized buffer containing
- * geometry data in the form of vertices. It contains a list of triangles.
+ * geometry data in the form of vertices. It contains a list of quads, four
+ * vertices each, drawn with the indices written by quadIndices.
  */
 class Buffer {
 private:
     std::vector<Vertex> data_;
 
 protected:
-    void addTriangle(const Vertex& a, const Vertex& b, const Vertex& c) {
-        data_.push_back(a);
-        data_.push_back(b);
-        data_.push_back(c);
-    }
-
     void addQuad(Vertex a, Vertex b, Vertex c, Vertex d) {
         data_.push_back(a);
         data_.push_back(b);
-        data_.push_back(d);
-        data_.push_back(b);
         data_.push_back(c);
         data_.push_back(d);
     }
@@ -47,41 +45,100 @@ public:
         return data_.size();
     }
 
-    void operator+=(const Buffer& buffer) {
-        data_.insert(data_.end(), buffer.begin(), buffer.end());
+    size_t capacity() const {
+        return data_.capacity();
+    }
+
+    /**
+     * Ensures room for the given number of vertices, so that adding up to that
+     * many does not reallocate.
+     */
+    void reserve(size_t size) {
+        data_.reserve(size);
     }
 
-    void translate(float x, float y, float z) {
-        for (Vertex &v: data_) {
-            v.position[0] += x;
-            v.position[1] += y;
-            v.position[2] += z;
+    /**
+     * Removes every vertex while keeping the allocated storage for reuse.
+     */
+    void clear() {
+        data_.clear();
+    }
+
+    /**
+     * The type of the indices drawing quads. A mesh drawn with them holds at
+     * most one section, whose vertices 16 bits can address.
+     */
+    using Index = uint16_t;
+
+    /**
+     * Writes the indices of the given number of quads, splitting the quad with
+     * vertices a, b, c and d into the triangles a, b, d and b, c, d.
+     */
+    static void quadIndices(size_t quads, Index *indices) {
+        assert(quads * 4 <= size_t(1) << (8 * sizeof(Index)));
+        for (size_t q = 0; q < quads; q++) {
+            const Index v = q * 4;
+            indices[0] = v;
+            indices[1] = v + 1;
+            indices[2] = v + 3;
+            indices[3] = v + 1;
+            indices[4] = v + 2;
+            indices[5] = v + 3;
+            indices += 6;
         }
     }
+
+    void operator+=(const Buffer& buffer) {
+        data_.insert(data_.end(), buffer.begin(), buffer.end());
+    }
 };
 
+#ifdef __OBJC__
 
 using NativeDevice = id<MTLDevice>;
 
+/**
+ * The NativeBuffer class is a vertex buffer in device memory. Copies share the
+ * same underlying buffer, which is released along with the last copy. Vertex
+ * positions are relative to the block at origin.
+ */
 class NativeBuffer {
 private:
     id<MTLBuffer> data_ = nullptr;
     size_t size_ = 0;
     size_t capacity_ = 0;
+    simd::int3 origin_ = {0, 0, 0};
 public:
     float secondsSinceFirstLoaded_ = 0.0;
 
 
     NativeBuffer() = default;
     NativeBuffer(const NativeBuffer& buffer) {
-        data_ = buffer.data_;
+        data_ = [buffer.data_ retain];
         size_ = buffer.size_;
         capacity_ = buffer.capacity_;
+        origin_ = buffer.origin_;
         secondsSinceFirstLoaded_ = buffer.secondsSinceFirstLoaded_;
     };
 
-    NativeBuffer(NativeDevice device, size_t capacity) {
+    NativeBuffer& operator=(const NativeBuffer& buffer) {
+        [buffer.data_ retain];
+        [data_ release];
+        data_ = buffer.data_;
+        size_ = buffer.size_;
+        capacity_ = buffer.capacity_;
+        origin_ = buffer.origin_;
+        secondsSinceFirstLoaded_ = buffer.secondsSinceFirstLoaded_;
+        return *this;
+    }
+
+    ~NativeBuffer() {
+        [data_ release];
+    }
+
+    NativeBuffer(NativeDevice device, size_t capacity, simd::int3 origin) {
         capacity_ = capacity;
+        origin_ = origin;
         data_ = [device newBufferWithLength: (capacity * sizeof(Vertex)) 
                         options: MTLResourceOptionCPUCacheModeDefault];
     }
@@ -89,6 +146,10 @@ public:
     float secondsSinceFirstLoaded() const {
         return secondsSinceFirstLoaded_;
     }
+    simd::int3 origin() const {
+        return origin_;
+    }
+
     id<MTLBuffer> data() const {
         return data_;
     }
@@ -101,12 +162,177 @@ public:
         return capacity_;
     }
 
+    /**
+     * Returns the number of indices drawing every quad in this buffer.
+     */
+    int indexCount() const {
+        return size_ / 4 * 6;
+    }
+
+    /**
+     * Returns the number of bytes of device memory held by this buffer.
+     */
+    size_t memoryUsage() const {
+        return capacity_ * sizeof(Vertex);
+    }
+
     void fill(const Buffer &buffer) {
-        size_ = buffer.size();
+        fill(buffer.data(), buffer.size());
+    }
+
+    /**
+     * Copies the given vertices into this buffer, which may read them
+     * straight from a memory mapped file.
+     */
+    void fill(const Vertex *vertices, size_t count) {
+        size_ = count;
         assert(size_ <= capacity_);
-        memcpy([data_ contents], buffer.data(), buffer.size() * sizeof(Vertex));
+        memcpy([data_ contents], vertices, count * sizeof(Vertex));
+    }
+
+};
+
+/**
+ * The NativeIndexBuffer class holds the indices drawing up to a fixed number
+ * of quads, shared by every NativeBuffer. Copies share the same underlying
+ * buffer.
+ */
+class NativeIndexBuffer {
+private:
+    id<MTLBuffer> data_ = nullptr;
+    size_t quads_ = 0;
+public:
+
+    NativeIndexBuffer() = default;
+    NativeIndexBuffer(const NativeIndexBuffer& buffer) {
+        data_ = [buffer.data_ retain];
+        quads_ = buffer.quads_;
+    }
+
+    NativeIndexBuffer& operator=(const NativeIndexBuffer& buffer) {
+        [buffer.data_ retain];
+        [data_ release];
+        data_ = buffer.data_;
+        quads_ = buffer.quads_;
+        return *this;
+    }
+
+    ~NativeIndexBuffer() {
+        [data_ release];
     }
 
+    NativeIndexBuffer(NativeDevice device, size_t quads) {
+        quads_ = quads;
+        data_ = [device newBufferWithLength: (quads * 6 * sizeof(Buffer::Index))
+                        options: MTLResourceOptionCPUCacheModeDefault];
+        Buffer::quadIndices(quads, (Buffer::Index*) [data_ contents]);
+    }
+
+    id<MTLBuffer> data() const {
+        return data_;
+    }
+
+    size_t quads() const {
+        return quads_;
+    }
 };
 
+#else
+
+/**
+ * Without Metal there is no device, and native buffers are held in host
+ * memory so that everything above the renderer can run headless.
+ */
+using NativeDevice = void*;
+
+/**
+ * The NativeBuffer class is a vertex buffer in host memory, standing in for
+ * the Metal buffer. Copies share the same underlying storage. Vertex
+ * positions are relative to the block at origin.
+ */
+class NativeBuffer {
+private:
+    std::shared_ptr<std::vector<Vertex>> data_;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    simd::int3 origin_ = {0, 0, 0};
+public:
+    float secondsSinceFirstLoaded_ = 0.0;
+
+    NativeBuffer() = default;
+
+    NativeBuffer(NativeDevice device, size_t capacity, simd::int3 origin) {
+        capacity_ = capacity;
+        origin_ = origin;
+        data_ = std::make_shared<std::vector<Vertex>>(capacity);
+    }
+
+    float secondsSinceFirstLoaded() const {
+        return secondsSinceFirstLoaded_;
+    }
+
+    simd::int3 origin() const {
+        return origin_;
+    }
+
+    const Vertex* data() const {
+        return data_ ? data_->data() : nullptr;
+    }
+
+    int size() const {
+        return size_;
+    }
+
+    int capacity() const {
+        return capacity_;
+    }
+
+    int indexCount() const {
+        return size_ / 4 * 6;
+    }
+
+    size_t memoryUsage() const {
+        return capacity_ * sizeof(Vertex);
+    }
+
+    void fill(const Buffer &buffer) {
+        fill(buffer.data(), buffer.size());
+    }
+
+    void fill(const Vertex *vertices, size_t count) {
+        size_ = count;
+        assert(size_ <= capacity_);
+        if (count > 0) memcpy(data_->data(), vertices, count * sizeof(Vertex));
+    }
+};
+
+/**
+ * The NativeIndexBuffer class holds the indices drawing up to a fixed number
+ * of quads in host memory. Copies share the same underlying storage.
+ */
+class NativeIndexBuffer {
+private:
+    std::shared_ptr<std::vector<Buffer::Index>> data_;
+    size_t quads_ = 0;
+public:
+
+    NativeIndexBuffer() = default;
+
+    NativeIndexBuffer(NativeDevice device, size_t quads) {
+        quads_ = quads;
+        data_ = std::make_shared<std::vector<Buffer::Index>>(quads * 6);
+        Buffer::quadIndices(quads, data_->data());
+    }
+
+    const Buffer::Index* data() const {
+        return data_ ? data_->data() : nullptr;
+    }
+
+    size_t quads() const {
+        return quads_;
+    }
+};
+
+#endif
+
 #endif /* BUFFER_H */
\ No newline at end of file
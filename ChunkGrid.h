@@ -0,0 +1,184 @@
+#ifndef CHUNK_GRID_H
+#define CHUNK_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+/**
+ * The ChunkGrid class holds pointers to the chunks within a circle of chunk
+ * locations around a center. Slots are laid out toroidally, the chunk at
+ * (x, y) living in slot (x mod n, y mod n) for a grid n chunks wide, so moving
+ * the center only touches the slots of the locations entering and leaving
+ * the circle.
+ */
+template<typename T>
+class ChunkGrid {
+public:
+    using Location = std::pair<int, int>;
+
+private:
+    int radius_ = -1;
+    int size_ = 0;
+    Location center_ = {0, 0};
+    std::vector<T*> slots_;
+    std::vector<int> spans_;
+    std::vector<T*> items_;
+
+    static int mod(int a, int n) {
+        const int m = a % n;
+        return m < 0 ? m + n : m;
+    }
+
+    T*& slot(Location loc) {
+        return slots_[mod(loc.second, size_) * size_ + mod(loc.first, size_)];
+    }
+
+    /**
+     * Returns the first and last x in the circle around the given center on
+     * row y, with first greater than last if the row misses the circle.
+     */
+    std::pair<int, int> row(Location center, int y) const {
+        const int j = y - center.second;
+        if (radius_ < 0 || j < -radius_ || j > radius_) return {1, 0};
+        const int w = spans_[j + radius_];
+        return {center.first - w, center.first + w};
+    }
+
+    void rebuildItems() {
+        items_.clear();
+        for (int y = center_.second - radius_; y <= center_.second + radius_; y++) {
+            const std::pair<int, int> span = row(center_, y);
+            for (int x = span.first; x <= span.second; x++) {
+                items_.push_back(slot({x, y}));
+            }
+        }
+    }
+
+    template<typename Unload>
+    void unloadAll(Unload &unload) {
+        for (T *&item: slots_) {
+            if (item != nullptr) unload(item);
+            item = nullptr;
+        }
+    }
+
+    template<typename Load>
+    void loadAll(Load &load) {
+        for (int y = center_.second - radius_; y <= center_.second + radius_; y++) {
+            const std::pair<int, int> span = row(center_, y);
+            for (int x = span.first; x <= span.second; x++) {
+                slot({x, y}) = load(Location(x, y));
+            }
+        }
+    }
+
+public:
+
+    /**
+     * Centers the grid on the given location with the given radius. Chunks of
+     * the locations leaving the circle are passed to unload before load is
+     * called for each location entering it, which returns the chunk to hold.
+     * Changing the radius or moving across most of the grid reloads every
+     * location.
+     */
+    template<typename Load, typename Unload>
+    void update(Location center, int radius, Load load, Unload unload) {
+        if (radius != radius_) {
+            unloadAll(unload);
+            radius_ = radius;
+            size_ = 2 * radius + 1;
+            slots_.assign(size_ * size_, nullptr);
+            spans_.resize(size_);
+            for (int j = -radius; j <= radius; j++) {
+                spans_[j + radius] = (int) std::sqrt((double) (radius * radius - j * j));
+            }
+            center_ = center;
+            loadAll(load);
+            rebuildItems();
+            return;
+        }
+
+        if (center == center_) return;
+
+        const Location previous = center_;
+        if (std::abs(center.first - previous.first) >= size_ || std::abs(center.second - previous.second) >= size_) {
+            unloadAll(unload);
+            center_ = center;
+            loadAll(load);
+            rebuildItems();
+            return;
+        }
+
+        const int y0 = std::min(previous.second, center.second) - radius_;
+        const int y1 = std::max(previous.second, center.second) + radius_;
+
+        // Both passes share slots, so everything leaving is cleared before
+        // anything entering can land in the same slot.
+        for (int y = y0; y <= y1; y++) {
+            const std::pair<int, int> before = row(previous, y);
+            const std::pair<int, int> after = row(center, y);
+            for (int x = before.first; x <= before.second; x++) {
+                if (x >= after.first && x <= after.second) continue;
+                T *&item = slot({x, y});
+                unload(item);
+                item = nullptr;
+            }
+        }
+        for (int y = y0; y <= y1; y++) {
+            const std::pair<int, int> before = row(previous, y);
+            const std::pair<int, int> after = row(center, y);
+            for (int x = after.first; x <= after.second; x++) {
+                if (x >= before.first && x <= before.second) continue;
+                slot({x, y}) = load(Location(x, y));
+            }
+        }
+
+        center_ = center;
+        rebuildItems();
+    }
+
+    /**
+     * Returns true if the given location lies within the circle.
+     */
+    bool contains(Location loc) const {
+        const std::pair<int, int> span = row(center_, loc.second);
+        return loc.first >= span.first && loc.first <= span.second;
+    }
+
+    /**
+     * Returns the chunk at the given location, or nullptr if the location
+     * lies outside the circle.
+     */
+    T* get(Location loc) const {
+        if (!contains(loc)) return nullptr;
+        return slots_[mod(loc.second, size_) * size_ + mod(loc.first, size_)];
+    }
+
+    /**
+     * Returns the chunk offset from the given location by dx and dy, or
+     * nullptr if that location lies outside the circle.
+     */
+    T* neighbour(Location loc, int dx, int dy) const {
+        return get({loc.first + dx, loc.second + dy});
+    }
+
+    /**
+     * Returns every chunk within the circle, row by row.
+     */
+    const std::vector<T*>& items() const {
+        return items_;
+    }
+
+    Location center() const {
+        return center_;
+    }
+
+    int radius() const {
+        return radius_;
+    }
+};
+
+#endif /* CHUNK_GRID_H */
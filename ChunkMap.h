@@ -0,0 +1,185 @@
+#ifndef CHUNK_MAP_H
+#define CHUNK_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * Hashes a chunk location by packing both coordinates into 64 bits and mixing
+ * them with the splitmix64 finalizer, so that nearby, diagonal and mirrored
+ * locations spread evenly over the table.
+ */
+struct LocationHash {
+    static uint64_t pack(std::pair<int, int> loc) {
+        return (uint64_t) (uint32_t) loc.first << 32 | (uint32_t) loc.second;
+    }
+
+    static uint64_t mix(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    size_t operator()(std::pair<int, int> loc) const {
+        return mix(pack(loc));
+    }
+};
+
+/**
+ * The ChunkMap class maps chunk locations to values in a flat open-addressing
+ * table with linear probing. Values are held through pointers, so their
+ * addresses stay stable as the table grows, and erasing shifts the following
+ * entries back rather than leaving tombstones.
+ */
+template<typename V>
+class ChunkMap {
+public:
+    using Location = std::pair<int, int>;
+
+private:
+    struct Slot {
+        uint64_t key = 0;
+        std::unique_ptr<V> value;
+    };
+
+    static constexpr size_t MIN_CAPACITY = 16;
+
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+    size_t mask_ = 0;
+
+    size_t home(uint64_t key) const {
+        return LocationHash::mix(key) & mask_;
+    }
+
+    size_t find(uint64_t key) const {
+        if (slots_.empty()) return SIZE_MAX;
+        for (size_t i = home(key);; i = (i + 1) & mask_) {
+            if (!slots_[i].value) return SIZE_MAX;
+            if (slots_[i].key == key) return i;
+        }
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> slots(capacity);
+        std::swap(slots, slots_);
+        mask_ = capacity - 1;
+        for (Slot &slot: slots) {
+            if (!slot.value) continue;
+            size_t i = home(slot.key);
+            while (slots_[i].value) i = (i + 1) & mask_;
+            slots_[i] = std::move(slot);
+        }
+    }
+
+public:
+
+    class iterator {
+    private:
+        const std::vector<Slot> *slots_;
+        size_t i_;
+
+        void skip() {
+            while (i_ < slots_->size() && !(*slots_)[i_].value) i_++;
+        }
+
+    public:
+        struct Entry {
+            Location first;
+            V &second;
+        };
+
+        iterator(const std::vector<Slot> *slots, size_t i): slots_(slots), i_(i) {
+            skip();
+        }
+
+        Entry operator*() const {
+            const Slot &slot = (*slots_)[i_];
+            return {Location((int) (slot.key >> 32), (int) (uint32_t) slot.key), *slot.value};
+        }
+
+        iterator& operator++() {
+            i_++;
+            skip();
+            return *this;
+        }
+
+        bool operator!=(const iterator &it) const {
+            return i_ != it.i_;
+        }
+    };
+
+    iterator begin() const {
+        return iterator(&slots_, 0);
+    }
+
+    iterator end() const {
+        return iterator(&slots_, slots_.size());
+    }
+
+    /**
+     * Returns the value at the given location, or nullptr if there is none.
+     */
+    V* get(Location loc) const {
+        const size_t i = find(LocationHash::pack(loc));
+        return i == SIZE_MAX ? nullptr : slots_[i].value.get();
+    }
+
+    /**
+     * Stores the given value at the given location unless one is already
+     * there, and returns the value at the location.
+     */
+    V* insert(Location loc, std::unique_ptr<V> value) {
+        const uint64_t key = LocationHash::pack(loc);
+        if (V *existing = get(loc)) return existing;
+        if ((size_ + 1) * 4 > slots_.size() * 3) {
+            rehash(slots_.empty() ? MIN_CAPACITY : slots_.size() * 2);
+        }
+        size_t i = home(key);
+        while (slots_[i].value) i = (i + 1) & mask_;
+        slots_[i].key = key;
+        slots_[i].value = std::move(value);
+        size_++;
+        return slots_[i].value.get();
+    }
+
+    /**
+     * Destroys the value at the given location. Returns false if there is
+     * none.
+     */
+    bool erase(Location loc) {
+        size_t i = find(LocationHash::pack(loc));
+        if (i == SIZE_MAX) return false;
+        slots_[i].value.reset();
+        size_--;
+
+        // Move back every following entry of the probe sequence that may
+        // occupy the freed slot, so lookups never stop short of it.
+        for (size_t j = (i + 1) & mask_; slots_[j].value; j = (j + 1) & mask_) {
+            const size_t h = home(slots_[j].key);
+            if (((j - h) & mask_) >= ((j - i) & mask_)) {
+                slots_[i] = std::move(slots_[j]);
+                i = j;
+            }
+        }
+        return true;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    /**
+     * Returns the number of bytes held by the table itself, excluding the
+     * values it points to.
+     */
+    size_t memoryUsage() const {
+        return sizeof(*this) + slots_.capacity() * sizeof(Slot);
+    }
+};
+
+#endif /* CHUNK_MAP_H */
@@ -0,0 +1,218 @@
+#ifndef DRAW_LIST_H
+#define DRAW_LIST_H
+
+#include "Buffer.h"
+#include "linalg.h"
+#include "PlayerCamera.h"
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * The RenderBackend class is the interface through which a DrawList is
+ * issued to a graphics API. State set through it stays bound until it is set
+ * again, so the draw list only sets what changes between draws.
+ */
+class RenderBackend {
+public:
+    virtual ~RenderBackend() = default;
+
+    /**
+     * Starts a frame and binds the state shared by every draw in it, along
+     * with the camera matrix.
+     */
+    virtual void beginFrame(const matrix_float4x4 &camera) = 0;
+
+    /**
+     * Binds the vertex buffer, starting at the given vertex.
+     */
+    virtual void setVertexBuffer(const NativeBuffer &buffer, size_t offset) = 0;
+
+    /**
+     * Sets the matrix placing the bound vertices relative to the camera.
+     */
+    virtual void setTransform(const matrix_float4x4 &mvp) = 0;
+
+    /**
+     * Sets the time since the bound vertices were first loaded, used to fade
+     * them in.
+     */
+    virtual void setFade(float seconds) = 0;
+
+    /**
+     * Draws the quads of the bound vertex buffer with the given number of
+     * indices from the shared quad index buffer.
+     */
+    virtual void drawQuads(size_t indexCount) = 0;
+
+    virtual void endFrame() = 0;
+};
+
+/**
+ * The DrawCommand struct describes one draw of a range of quads from a buffer
+ * whose vertices are relative to the block at origin. Commands are drawn in
+ * order of increasing key.
+ */
+struct DrawCommand {
+    NativeBuffer buffer;
+    size_t offset;
+    size_t count;
+    simd::int3 origin;
+    float key;
+};
+
+/**
+ * The DrawList class collects the draws of a frame, sorts them front to back
+ * so early depth testing rejects hidden fragments, and issues them to a
+ * backend without repeating state that is already bound.
+ */
+class DrawList {
+private:
+    std::vector<DrawCommand> commands_;
+
+public:
+
+    /**
+     * Fades are clamped to the time after which the shader draws vertices
+     * fully opaque, so buffers loaded long ago share the same fade.
+     */
+    static constexpr float FADE_SECONDS = 0.5f;
+
+    void clear() {
+        commands_.clear();
+    }
+
+    /**
+     * Adds a draw of every quad in the given buffer. The key is the squared
+     * distance from the camera to the center of the given box, relative to
+     * the buffer's origin.
+     */
+    void add(const NativeBuffer &buffer, const PlayerCamera &camera, simd::float3 lo, simd::float3 hi) {
+        const simd::int3 origin = buffer.origin();
+        const float dx = origin[0] + (lo[0] + hi[0]) / 2 - 0.5f - camera.x();
+        const float dy = origin[1] + (lo[1] + hi[1]) / 2 - 0.5f - camera.y();
+        const float dz = origin[2] + (lo[2] + hi[2]) / 2 - 0.5f - camera.z();
+        commands_.push_back({buffer, 0, (size_t) buffer.indexCount(), origin, dx * dx + dy * dy + dz * dz});
+    }
+
+    void sort() {
+        std::sort(commands_.begin(), commands_.end(), [](const DrawCommand &a, const DrawCommand &b) {
+            return a.key < b.key;
+        });
+    }
+
+    const std::vector<DrawCommand>& commands() const {
+        return commands_;
+    }
+
+    size_t size() const {
+        return commands_.size();
+    }
+
+    /**
+     * Issues every command in order as one frame seen from the given camera.
+     * Each buffer is placed relative to the camera in double precision.
+     */
+    void submit(RenderBackend &backend, const PlayerCamera &camera) const {
+        backend.beginFrame(camera.viewProjection());
+
+        const DrawCommand *bound = nullptr;
+        float fade = -1.0f;
+        for (const DrawCommand &command: commands_) {
+            if (bound == nullptr || bound->buffer.data() != command.buffer.data() || bound->offset != command.offset) {
+                backend.setVertexBuffer(command.buffer, command.offset);
+            }
+            if (bound == nullptr || bound->origin[0] != command.origin[0] || bound->origin[1] != command.origin[1] || bound->origin[2] != command.origin[2]) {
+                backend.setTransform(matrix_from_translation(
+                    (double) command.origin[0] - 0.5 - camera.x(),
+                    (double) command.origin[2] - 0.5 - camera.z(),
+                    (double) command.origin[1] - 0.5 - camera.y()
+                ));
+            }
+            const float f = std::min(command.buffer.secondsSinceFirstLoaded(), FADE_SECONDS);
+            if (f != fade) {
+                backend.setFade(f);
+                fade = f;
+            }
+            backend.drawQuads(command.count);
+            bound = &command;
+        }
+
+        backend.endFrame();
+    }
+};
+
+/**
+ * The RecordingBackend class records the calls made to it instead of drawing,
+ * so the commands and their order can be inspected without a GPU.
+ */
+class RecordingBackend: public RenderBackend {
+public:
+    enum class Call {
+        BeginFrame,
+        SetVertexBuffer,
+        SetTransform,
+        SetFade,
+        DrawQuads,
+        EndFrame
+    };
+
+    /**
+     * A recorded call. Value is the offset of a bound vertex buffer or the
+     * index count of a draw, and buffer the vertices of a bound vertex
+     * buffer.
+     */
+    struct Record {
+        Call call;
+        size_t value;
+        const Vertex *buffer;
+    };
+
+private:
+    std::vector<Record> records_;
+
+public:
+
+    void beginFrame(const matrix_float4x4 &camera) override {
+        records_.push_back({Call::BeginFrame, 0, nullptr});
+    }
+
+    void setVertexBuffer(const NativeBuffer &buffer, size_t offset) override {
+        records_.push_back({Call::SetVertexBuffer, offset, buffer.data()});
+    }
+
+    void setTransform(const matrix_float4x4 &mvp) override {
+        records_.push_back({Call::SetTransform, 0, nullptr});
+    }
+
+    void setFade(float seconds) override {
+        records_.push_back({Call::SetFade, 0, nullptr});
+    }
+
+    void drawQuads(size_t indexCount) override {
+        records_.push_back({Call::DrawQuads, indexCount, nullptr});
+    }
+
+    void endFrame() override {
+        records_.push_back({Call::EndFrame, 0, nullptr});
+    }
+
+    const std::vector<Record>& records() const {
+        return records_;
+    }
+
+    /**
+     * Returns the number of recorded calls of the given kind.
+     */
+    size_t count(Call call) const {
+        return std::count_if(records_.begin(), records_.end(), [=](const Record &record) {
+            return record.call == call;
+        });
+    }
+
+    void clear() {
+        records_.clear();
+    }
+};
+
+#endif /* DRAW_LIST_H */
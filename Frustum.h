@@ -0,0 +1,46 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "Simd.h"
+
+/**
+ * The Frustum class holds the six planes bounding the volume that a view
+ * projection matrix maps into Metal's clip space, expressed in the space the
+ * matrix transforms from.
+ */
+class Frustum {
+private:
+    simd::float4 planes_[6];
+
+public:
+
+    Frustum(const matrix_float4x4 &m) {
+        simd::float4 rows[4];
+        for (int i = 0; i < 4; i++) {
+            rows[i] = simd::float4{m.columns[0][i], m.columns[1][i], m.columns[2][i], m.columns[3][i]};
+        }
+        planes_[0] = rows[3] + rows[0];
+        planes_[1] = rows[3] - rows[0];
+        planes_[2] = rows[3] + rows[1];
+        planes_[3] = rows[3] - rows[1];
+        planes_[4] = rows[2];
+        planes_[5] = rows[3] - rows[2];
+    }
+
+    /**
+     * Returns false if the box spanning lo to hi lies entirely outside the
+     * frustum. Boxes just outside a corner of the frustum may still return
+     * true.
+     */
+    bool intersects(simd::float3 lo, simd::float3 hi) const {
+        for (const simd::float4 &plane: planes_) {
+            const float x = plane[0] >= 0 ? hi[0] : lo[0];
+            const float y = plane[1] >= 0 ? hi[1] : lo[1];
+            const float z = plane[2] >= 0 ? hi[2] : lo[2];
+            if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0) return false;
+        }
+        return true;
+    }
+};
+
+#endif /* FRUSTUM_H */
@@ -2,16 +2,38 @@
 #define GAME_ENGINE_H
 
 #include "Buffer.h"
+#include "BlockStorage.h"
 #include "linalg.h"
 #include "PlayerCamera.h"
 #include "Perlin.h"
+#include "Terrain.h"
+#include "ThreadPool.h"
+#include "Frustum.h"
+#include "DrawList.h"
+#include "ChunkGrid.h"
+#include "ChunkMap.h"
+#include "Region.h"
+#include "MeshCache.h"
+#include "Visibility.h"
+#include "Trace.h"
+#include "Metrics.h"
+#include "Simulation.h"
 
 #include <chrono>
+#include <deque>
+#include <functional>
 #include <vector>
 #include <array>
+#include <atomic>
 #include <iostream>
 #include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <future>
+#include <memory>
 
 int max(int a, int b) {
     return a > b ? a : b;
@@ -33,7 +55,7 @@ public:
     static constexpr uint8_t Water = 0x6;
     static constexpr uint8_t Ice = 0x7;
 
-    std::pair<int, int> getTexture(uint8_t block, uint8_t side) {
+    static std::pair<int, int> getTexture(uint8_t block, uint8_t side) {
         switch (block) {
         case Grass:
             if (side == Block::Top) return {1, 0};
@@ -64,70 +86,71 @@ public:
 
     using FaceSet = uint8_t;
 
-    Block(uint8_t block, FaceSet faceSet) {
-       
-       float N = 16.0f;
-
-        if (faceSet & Top) {
-            int i, j; std::tie(i, j) = getTexture(block, Top);
-            Vertex a = {{-0.5, 0.5, 0.5}, {i / N, (j + 1) / N}, {0.0, 1.0, 0.0}};
-            Vertex b = {{-0.5, -0.5, 0.5}, {(i + 1) / N, (j + 1) / N}, {0.0, 1.0, 0.0}};
-            Vertex c = {{0.5, -0.5, 0.5}, {(i + 1) / N, j / N}, {0.0, 1.0, 0.0}};
-            Vertex d = {{0.5, 0.5, 0.5}, {i / N, j / N}, {0.0, 1.0, 0.0}};
-            addQuad(d, c, b, a);
-        }
-
-        if (faceSet & Bottom) {
-            int i, j; std::tie(i, j) = getTexture(block, Bottom);
-            Vertex a = {{-0.5, 0.5, -0.5}, {i / N, (j + 1) / N}, {0.0, -1.0, 0.0}};
-            Vertex b = {{-0.5, -0.5, -0.5}, {(i + 1) / N, (j + 1) / N}, {0.0, -1.0, 0.0}};
-            Vertex c = {{0.5, -0.5, -0.5}, {(i + 1) / N, j / N}, {0.0, -1.0, 0.0}};
-            Vertex d = {{0.5, 0.5, -0.5}, {i / N, j / N}, {0.0, -1.0, 0.0}};
-            addQuad(a, b, c, d);
-
-        }
-
-        if (faceSet & Left) {
-            int i, j; std::tie(i, j) = getTexture(block, Left);
-            Vertex a = {{-0.5, 0.5, -0.5}, {i / N, (j + 1) / N}, {-1.0, 0.0, 0.0}};
-            Vertex b = {{-0.5, -0.5, -0.5}, {(i + 1) / N, (j + 1) / N}, {-1.0, 0.0, 0.0}};
-            Vertex c = {{-0.5, -0.5, 0.5}, {(i + 1) / N, j / N}, {-1.0, 0.0, 0.0}};
-            Vertex d = {{-0.5, 0.5, 0.5}, {i / N, j / N}, {-1.0, 0.0, 0.0}};
-            addQuad(d, c, b, a);
-        }
-
-        if (faceSet & Right) {
-            int i, j; std::tie(i, j) = getTexture(block, Right);
-            Vertex a = {{0.5, 0.5, -0.5}, {i / N, (j + 1) / N}, {1.0, 0.0, 0.0}};
-            Vertex b = {{0.5, -0.5, -0.5}, {(i + 1) / N, (j + 1) / N}, {1.0, 0.0, 0.0}};
-            Vertex c = {{0.5, -0.5, 0.5}, {(i + 1) / N, j / N}, {1.0, 0.0, 0.0}};
-            Vertex d = {{0.5, 0.5, 0.5}, {i / N, j / N}, {1.0, 0.0, 0.0}};
-            addQuad(a, b, c, d);
-        }
-
-        if (faceSet & Back) {
-            int i, j; std::tie(i, j) = getTexture(block, Back);
-            Vertex a = {{0.5, 0.5, -0.5}, {i / N, (j + 1) / N}, {0.0, 0.0, 1.0}};
-            Vertex b = {{-0.5, 0.5, -0.5}, {(i + 1) / N, (j + 1) / N},{0.0, 0.0, 1.0}};
-            Vertex c = {{-0.5, 0.5, 0.5}, {(i + 1) / N, j / N}, {0.0, 0.0, 1.0}};
-            Vertex d = {{0.5, 0.5, 0.5}, {i / N, j / N}, {0.0, 0.0, 1.0}};
-            addQuad(d, c, b, a);
-        }
+    Block() = default;
+
+    /**
+     * Creates the given faces of a block whose lower corner is at the given
+     * position relative to the chunk.
+     */
+    Block(uint8_t block, FaceSet faceSet, simd::int3 position) {
+        const simd::int3 hi = {position[0] + 1, position[1] + 1, position[2] + 1};
+        if (faceSet & Top) addFace(Top, getTexture(block, Top), position, hi);
+        if (faceSet & Bottom) addFace(Bottom, getTexture(block, Bottom), position, hi);
+        if (faceSet & Left) addFace(Left, getTexture(block, Left), position, hi);
+        if (faceSet & Right) addFace(Right, getTexture(block, Right), position, hi);
+        if (faceSet & Back) addFace(Back, getTexture(block, Back), position, hi);
+        if (faceSet & Front) addFace(Front, getTexture(block, Front), position, hi);
+    }
 
-        if (faceSet & Front) {
-            int i, j; std::tie(i, j) = getTexture(block, Front);
-            Vertex a = {{0.5, -0.5, -0.5}, {i / N, (j + 1) / N}, {0.0, 0.0, -1.0}};
-            Vertex b = {{-0.5, -0.5, -0.5}, {(i + 1) / N, (j + 1) / N}, {0.0, 0.0, -1.0}};
-            Vertex c = {{-0.5, -0.5, 0.5}, {(i + 1) / N, j / N}, {0.0, 0.0, -1.0}};
-            Vertex d = {{0.5, -0.5, 0.5}, {i / N, j / N}, {0.0, 0.0, -1.0}};
-            addQuad(a, b, c, d);
+    /**
+     * Adds the given side of the box spanning the block corners lo to hi,
+     * relative to the chunk. The texture tile is repeated once per block
+     * across the face.
+     */
+    void addFace(uint8_t side, std::pair<int, int> texture, simd::int3 lo, simd::int3 hi) {
+        const uint32_t face = __builtin_ctz(side);
+        const uint32_t tile = texture.first + 16 * texture.second;
+        auto corner = [=](int x, int y, int z) {
+            return makeVertex(x, y, z, face, tile);
+        };
+
+        if (side == Top) {
+            addQuad(corner(hi[0], hi[1], hi[2]), corner(hi[0], lo[1], hi[2]), corner(lo[0], lo[1], hi[2]), corner(lo[0], hi[1], hi[2]));
+        } else if (side == Bottom) {
+            addQuad(corner(lo[0], hi[1], lo[2]), corner(lo[0], lo[1], lo[2]), corner(hi[0], lo[1], lo[2]), corner(hi[0], hi[1], lo[2]));
+        } else if (side == Left) {
+            addQuad(corner(lo[0], hi[1], hi[2]), corner(lo[0], lo[1], hi[2]), corner(lo[0], lo[1], lo[2]), corner(lo[0], hi[1], lo[2]));
+        } else if (side == Right) {
+            addQuad(corner(hi[0], hi[1], lo[2]), corner(hi[0], lo[1], lo[2]), corner(hi[0], lo[1], hi[2]), corner(hi[0], hi[1], hi[2]));
+        } else if (side == Back) {
+            addQuad(corner(hi[0], hi[1], hi[2]), corner(lo[0], hi[1], hi[2]), corner(lo[0], hi[1], lo[2]), corner(hi[0], hi[1], lo[2]));
+        } else if (side == Front) {
+            addQuad(corner(hi[0], lo[1], lo[2]), corner(lo[0], lo[1], lo[2]), corner(lo[0], lo[1], hi[2]), corner(hi[0], lo[1], hi[2]));
         }
     }
 };
 
-class Biome {
-public:
-    static constexpr int SEA_LEVEL = 62;
+/**
+ * The ChunkMetrics struct holds the metrics chunks report to, looked up once
+ * by World so that chunks update them without a lookup by name.
+ */
+struct ChunkMetrics {
+    Counter &generated;
+    Histogram &generateTime;
+    Counter &sectionsMeshed;
+    Counter &verticesMeshed;
+    Histogram &meshTime;
+    Counter &heightmapsMeshed;
+    Histogram &requestToVisible;
+
+    explicit ChunkMetrics(MetricsRegistry &registry):
+        generated(registry.counter("chunk.generated")),
+        generateTime(registry.histogram("chunk.generate_us")),
+        sectionsMeshed(registry.counter("chunk.sections_meshed")),
+        verticesMeshed(registry.counter("chunk.vertices_meshed")),
+        meshTime(registry.histogram("chunk.mesh_us")),
+        heightmapsMeshed(registry.counter("chunk.heightmaps_meshed")),
+        requestToVisible(registry.histogram("chunk.request_to_visible_us")) {}
 };
 
 class Chunk {
@@ -136,158 +159,441 @@ public:
     static constexpr int HEIGHT = 256;
     using Location = std::pair<int, int>;
 
+    static constexpr int SECTION_HEIGHT = BlockStorage::SECTION_HEIGHT;
+    static constexpr int SECTION_COUNT = BlockStorage::SECTION_COUNT;
+    static constexpr uint16_t ALL_SECTIONS = (1 << SECTION_COUNT) - 1;
+
+    /**
+     * The most quads a section mesh can hold, reached when solid blocks and
+     * air alternate in every direction and each solid block shows all six
+     * faces. Heightmap meshes hold far fewer.
+     */
+    static constexpr size_t MAX_QUADS = WIDTH * WIDTH * SECTION_HEIGHT / 2 * 6;
+    static_assert(MAX_QUADS * 4 <= size_t(1) << (8 * sizeof(Buffer::Index)),
+                  "section vertices must fit in a quad index");
+
+    /**
+     * Bumped whenever the meshers change what they emit, so that meshes
+     * cached by an older version are rebuilt.
+     */
+    static constexpr uint32_t MESHER_VERSION = 1;
+
+    /**
+     * Level 0 draws the full section meshes. Each level above it draws one
+     * heightmap mesh of the chunk with cells twice as wide, up to 8x8 columns
+     * per cell.
+     */
+    static constexpr int LOD_LEVELS = 4;
+
+    /**
+     * The depth of the skirts hanging from the edges of a heightmap mesh,
+     * which hide the cracks to neighbours drawn at another level.
+     */
+    static constexpr int LOD_SKIRT_DEPTH = 16;
+
+    /**
+     * PerFace emits one quad for every visible block face. Greedy merges
+     * adjacent coplanar faces sharing a texture into larger quads.
+     */
+    enum class MeshingMode {
+        PerFace,
+        Greedy
+    };
+
 private:
-    uint8_t blocks[WIDTH + 2][WIDTH + 2][HEIGHT] = {};
+    BlockStorage blocks;
     Location location;
-    std::future<NativeBuffer> future_buffer_;
-    NativeBuffer buffer_;
-    bool modified_ = true;
+    /**
+     * The mesh of one section, uploaded to the device. Empty sections have an
+     * empty buffer.
+     */
+    struct SectionMesh {
+        int section;
+        NativeBuffer buffer;
+    };
+
+    /**
+     * A block change waiting to be applied, at a position relative to the
+     * chunk that may lie in the halo.
+     */
+    struct Edit {
+        int8_t x;
+        int8_t y;
+        uint8_t z;
+        uint8_t block;
+    };
+
+    std::vector<Edit> edits_;
+    std::future<void> future_blocks_;
+    std::future<std::vector<SectionMesh>> future_buffer_;
+    NativeBuffer buffers_[SECTION_COUNT];
+    uint16_t visibility_[SECTION_COUNT];
+    std::future<NativeBuffer> future_lod_;
+    NativeBuffer lod_buffer_;
+    int lod_buffer_level_ = 0;
+    int future_lod_level_ = 0;
+    int lod_ = 0;
+    bool lod_modified_ = false;
+    bool generated_ = false;
+    bool saved_ = false;
+    bool edited_ = false;
+    uint16_t modified_ = ALL_SECTIONS;
     bool loaded_ = false;
+    std::chrono::steady_clock::time_point created_time_ = std::chrono::steady_clock::now();
     std::chrono::steady_clock::time_point loaded_time_;
+    ChunkMetrics *metrics_ = nullptr;
+    /**
+     * Written by the meshing job and read on the render thread.
+     */
+    std::atomic<float> meshing_seconds_{0.0f};
+    uint64_t last_used_ = 0;
+
+    /**
+     * Scratch memory for meshing, allocated once per thread and reused for
+     * every chunk meshed on it. Holds a dense copy of the block storage so the
+     * meshers can read neighbouring blocks without unpacking palettes, the
+     * visible faces of every block and the output vertices.
+     */
+    struct MeshArena {
+        uint8_t blocks[WIDTH + 2][WIDTH + 2][HEIGHT];
+        Block::FaceSet faces[WIDTH][WIDTH][HEIGHT];
+        uint16_t mask[WIDTH * HEIGHT];
+        Block vertices;
+
+        /**
+         * Returns the block at the given position in the halo-padded block
+         * array, treating everything above and below the chunk as air.
+         */
+        uint8_t get(int x, int y, int z) const {
+            if (z < 0 || z >= HEIGHT) return Block::Air;
+            return blocks[x][y][z];
+        }
 
-public:
+        /**
+         * Returns the set of faces of the block at the given position that
+         * border air.
+         */
+        Block::FaceSet visibleFaces(int x, int y, int z) const {
+            Block::FaceSet visible_sides = 0;
+            if (blocks[x][y][z] == Block::Air) return visible_sides;
+            if (get(x + 1, y, z) == Block::Air) visible_sides |= Block::Right;
+            if (get(x - 1, y, z) == Block::Air) visible_sides |= Block::Left;
+            if (get(x, y + 1, z) == Block::Air) visible_sides |= Block::Back;
+            if (get(x, y - 1, z) == Block::Air) visible_sides |= Block::Front;
+            if (get(x, y, z + 1) == Block::Air) visible_sides |= Block::Top;
+            if (get(x, y, z - 1) == Block::Air) visible_sides |= Block::Bottom;
+            return visible_sides;
+        }
+    };
 
-    static int MountainBiomeHeight(int global_x, int global_y) {
-        float noise = perlin2d(global_x + 9134, global_y + 2514, 0.02, 3);
-        return Biome::SEA_LEVEL + 20 + (int) (72.0 / (1.0 + exp(-10.0 * (noise - 0.5))));
+    static MeshArena& meshArena() {
+        thread_local std::unique_ptr<MeshArena> arena(new MeshArena);
+        return *arena;
     }
 
-    static int SnowBiomeHeight(int global_x, int global_y) {
-        float noise = perlin2d(global_x, global_y, 0.025, 2);
-        return Biome::SEA_LEVEL + 40 * (noise - 0.5);
+    /**
+     * Returns true if no block of the given section can show a face: it holds
+     * only air, or it and the sections above and below hold no air. Below the
+     * lowest section counts as air.
+     */
+    bool isHidden(int section) const {
+        using Occupancy = BlockStorage::Occupancy;
+        if (blocks.occupancy(section) == Occupancy::Empty) return true;
+        return blocks.occupancy(section) == Occupancy::Full
+            && section > 0 && blocks.occupancy(section - 1) == Occupancy::Full
+            && section + 1 < SECTION_COUNT && blocks.occupancy(section + 1) == Occupancy::Full;
     }
 
-    static int GrassBiomeHeight(int global_x, int global_y) {
-        float noise = perlin2d(global_x, global_y, 0.025, 2);
-        return Biome::SEA_LEVEL + 40 * (noise - 0.5);
+    /**
+     * Decodes the given section and its neighbours into the arena and
+     * computes the visible faces of every block in the section. Returns the
+     * number of visible faces, which bounds the number of quads either mesher
+     * emits.
+     */
+    size_t prepare(MeshArena &arena, int section) const {
+        blocks.unpack(arena.blocks, section - 1, section + 2);
+
+        const int z0 = section * SECTION_HEIGHT;
+        const int z1 = z0 + SECTION_HEIGHT;
+        size_t count = 0;
+        for (int x = 0; x < WIDTH; x++) {
+            for (int y = 0; y < WIDTH; y++) {
+                for (int z = z0; z < z1; z++) {
+                    const Block::FaceSet faces = arena.visibleFaces(x + 1, y + 1, z);
+                    arena.faces[x][y][z] = faces;
+                    for (Block::FaceSet f = faces; f; f &= f - 1) count++;
+                }
+            }
+        }
+        return count;
     }
 
-    static int SandBiomeHeight(int global_x, int global_y) {
-        float noise = perlin2d(global_x, global_y, 0.015, 1);
-        return Biome::SEA_LEVEL + 40 * noise;
+    void meshPerFace(MeshArena &arena, int section) const {
+        static const uint8_t sides[] = {Block::Top, Block::Bottom, Block::Left, Block::Right, Block::Back, Block::Front};
+
+        const int z0 = section * SECTION_HEIGHT;
+        for (int x = 0; x < WIDTH; x++) {
+            for (int y = 0; y < WIDTH; y++) {
+                for (int z = z0; z < z0 + SECTION_HEIGHT; z++) {
+                    const Block::FaceSet faces = arena.faces[x][y][z];
+                    if (faces == 0) continue;
+                    const uint8_t block = arena.blocks[x + 1][y + 1][z];
+                    const simd::int3 lo = {x, y, z};
+                    const simd::int3 hi = {x + 1, y + 1, z + 1};
+                    for (uint8_t side: sides) {
+                        if (faces & side) arena.vertices.addFace(side, Block::getTexture(block, side), lo, hi);
+                    }
+                }
+            }
+        }
     }
 
-    Chunk(Location loc) {
-        location = loc;
-        for (int x = 0; x < WIDTH + 2; x++) {
-            for (int y = 0; y < WIDTH + 2; y++) {
-                const int global_x = x - 1 + location.first * WIDTH;
-                const int global_y = y - 1 + location.second * WIDTH;
+    /**
+     * Sweeps each of the six face directions one slice at a time. Visible
+     * faces in a slice are written to a mask keyed by texture tile, which is
+     * then covered by rectangles grown first along u and then along v.
+     */
+    void meshGreedy(MeshArena &arena, int section) const {
+        struct Direction { uint8_t side; int axis; };
+        static const Direction directions[] = {
+            {Block::Right, 0}, {Block::Left, 0},
+            {Block::Back, 1}, {Block::Front, 1},
+            {Block::Top, 2}, {Block::Bottom, 2},
+        };
+
+        const int base[3] = {0, 0, section * SECTION_HEIGHT};
+        const int size[3] = {WIDTH, WIDTH, SECTION_HEIGHT};
+        uint16_t *mask = arena.mask;
+
+        for (const Direction &d: directions) {
+            const int u = (d.axis + 1) % 3;
+            const int v = (d.axis + 2) % 3;
+            const int nu = size[u];
+            const int nv = size[v];
+
+            for (int n = 0; n < size[d.axis]; n++) {
+                bool empty = true;
+                for (int j = 0; j < nv; j++) {
+                    for (int i = 0; i < nu; i++) {
+                        int p[3];
+                        p[d.axis] = base[d.axis] + n;
+                        p[u] = base[u] + i;
+                        p[v] = base[v] + j;
+
+                        uint16_t key = 0;
+                        if (arena.faces[p[0]][p[1]][p[2]] & d.side) {
+                            int tx, ty; std::tie(tx, ty) = Block::getTexture(arena.blocks[p[0] + 1][p[1] + 1][p[2]], d.side);
+                            key = 1 + tx + 16 * ty;
+                            empty = false;
+                        }
+                        mask[j * nu + i] = key;
+                    }
+                }
+                if (empty) continue;
+
+                for (int j = 0; j < nv; j++) {
+                    for (int i = 0; i < nu;) {
+                        const uint16_t key = mask[j * nu + i];
+                        if (key == 0) {
+                            i++;
+                            continue;
+                        }
+
+                        int w = 1;
+                        while (i + w < nu && mask[j * nu + i + w] == key) w++;
 
-                float noise1 = perlin2d(global_x, global_y, 0.002, 3);
-                float noise2 = perlin2d(global_x + 5231, global_y + 8152, 0.002, 3);
-
-                
-                float mountain = 0.0;
-                float snow = 0.0;
-                float grass = 0.0;
-                float sand = 0.0;
-
-                if (noise1 >= 0.6 && noise2 >= 0.6) {
-                    mountain = 1.0;
-                } else if (noise1 >= 0.6 && noise2 >= 0.4) {
-                    mountain = abs(noise2 - 0.4) / 0.2;
-                } else if (noise1 >= 0.4 && noise2 >= 0.6) {
-                    mountain = abs(noise1 - 0.4) / 0.2;
-                } else if (noise1 >= 0.4 && noise2 >= 0.4) {
-                    mountain = abs(noise1 - 0.4) * abs(noise2 - 0.4) / 0.04;
+                        int h = 1;
+                        for (; j + h < nv; h++) {
+                            int k = 0;
+                            while (k < w && mask[(j + h) * nu + i + k] == key) k++;
+                            if (k < w) break;
+                        }
+
+                        for (int l = 0; l < h; l++) {
+                            std::fill_n(&mask[(j + l) * nu + i], w, 0);
+                        }
+
+                        simd::int3 lo, hi;
+                        lo[d.axis] = base[d.axis] + n;
+                        hi[d.axis] = base[d.axis] + n + 1;
+                        lo[u] = base[u] + i;
+                        hi[u] = base[u] + i + w;
+                        lo[v] = base[v] + j;
+                        hi[v] = base[v] + j + h;
+                        arena.vertices.addFace(d.side, {(key - 1) % 16, (key - 1) / 16}, lo, hi);
+
+                        i += w;
+                    }
                 }
+            }
+        }
+    }
+
+    static uint64_t microseconds(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+
+    /**
+     * Stamps the time the first meshes of this chunk were picked up, and
+     * reports how long that took from the chunk's creation.
+     */
+    void markLoaded() {
+        if (loaded_time_ != std::chrono::steady_clock::time_point()) return;
+        loaded_time_ = std::chrono::steady_clock::now();
+        if (metrics_ != nullptr) metrics_->requestToVisible.record(microseconds(loaded_time_ - created_time_));
+    }
 
-                if (noise1 >= 0.6 && noise2 <= 0.4) {
-                    snow = 1.0;
-                } else if (noise1 >= 0.6 && noise2 <= 0.6) {
-                    snow = abs(noise2 - 0.6) / 0.2;
-                } else if (noise1 >= 0.4 && noise2 <= 0.4) {
-                    snow = abs(noise1 - 0.4) / 0.2;
-                } else if (noise1 >= 0.4 && noise2 <= 0.6) {
-                    snow = abs(noise2 - 0.6) * abs(noise1 - 0.4) / 0.04;
+    /**
+     * Meshes the chunk as a heightmap at the given level of detail into the
+     * arena. Each cell of 2^level by 2^level columns becomes a column as tall
+     * as its highest block, topped with that block. Sides are added where a
+     * cell is taller than its neighbour, and skirts of LOD_SKIRT_DEPTH where
+     * it borders another chunk. Tops of equal height and block are merged
+     * along rows.
+     */
+    void meshLod(MeshArena &arena, int level) const {
+        constexpr int MAX_CELLS = WIDTH / 2;
+        const int cell = 1 << level;
+        const int n = WIDTH / cell;
+        int height[MAX_CELLS][MAX_CELLS];
+        uint8_t surface[MAX_CELLS][MAX_CELLS];
+
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                int top = -1;
+                uint8_t block = Block::Air;
+                for (int x = i * cell; x < (i + 1) * cell; x++) {
+                    for (int y = j * cell; y < (j + 1) * cell; y++) {
+                        const int z = blocks.top(x + 1, y + 1);
+                        if (z <= top) continue;
+                        top = z;
+                        block = blocks.get(x + 1, y + 1, z);
+                    }
                 }
+                height[i][j] = top + 1;
+                surface[i][j] = block;
+            }
+        }
 
-                if (noise1 <= 0.4 && noise2 >= 0.6) {
-                    grass = 1.0;
-                } else if (noise1 <= 0.4 && noise2 >= 0.4) {
-                    grass = abs(noise2 - 0.4) / 0.2;
-                } else if (noise1 <= 0.6 && noise2 >= 0.6) {
-                    grass = abs(noise1 - 0.6) / 0.2;
-                } else if (noise1 <= 0.6 && noise2 >= 0.4) {
-                    grass = abs(noise2 - 0.4) *  abs(noise1 - 0.6) / 0.04;
+        for (int j = 0; j < n; j++) {
+            for (int i = 0; i < n;) {
+                const int h = height[i][j];
+                int w = 1;
+                while (i + w < n && height[i + w][j] == h && surface[i + w][j] == surface[i][j]) w++;
+                if (h > 0) {
+                    arena.vertices.addFace(Block::Top, Block::getTexture(surface[i][j], Block::Top),
+                        {i * cell, j * cell, h - 1}, {(i + w) * cell, (j + 1) * cell, h});
                 }
+                i += w;
+            }
+        }
 
-                if (noise1 <= 0.4 && noise2 <= 0.4) {
-                    sand = 1.0;
-                } else if (noise1 <= 0.4 && noise2 <= 0.6) {
-                    sand = abs(noise2 - 0.6) / 0.2;
-                } else if (noise1 <= 0.6 && noise2 <= 0.4) {
-                    sand = abs(noise1 - 0.6) / 0.2;
-                } else if (noise1 <= 0.6 && noise2 <= 0.6) {
-                    sand = abs(noise1 - 0.6) * abs(noise2 - 0.6) / 0.04;
+        struct Side { uint8_t side; int dx; int dy; };
+        static const Side sides[] = {
+            {Block::Right, 1, 0}, {Block::Left, -1, 0},
+            {Block::Back, 0, 1}, {Block::Front, 0, -1},
+        };
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                const int h = height[i][j];
+                if (h == 0) continue;
+                for (const Side &side: sides) {
+                    const int ni = i + side.dx;
+                    const int nj = j + side.dy;
+                    const bool inside = ni >= 0 && ni < n && nj >= 0 && nj < n;
+                    const int bottom = inside ? height[ni][nj] : std::max(0, h - LOD_SKIRT_DEPTH);
+                    if (bottom >= h) continue;
+                    arena.vertices.addFace(side.side, Block::getTexture(surface[i][j], side.side),
+                        {i * cell, j * cell, bottom}, {(i + 1) * cell, (j + 1) * cell, h});
                 }
+            }
+        }
+    }
+
+public:
+
+    /**
+     * Creates a pending chunk. Its blocks are filled in by generate, which is
+     * normally run in the background by World.
+     */
+    Chunk(Location loc) {
+        location = loc;
+        std::fill_n(visibility_, SECTION_COUNT, SectionVisibility::ALL);
+    }
 
-                
-                float sum = mountain + snow + grass + sand;
-                mountain /= sum;
-                snow /= sum;
-                grass /= sum;
-                sand /= sum;
-                
-
-                int height = mountain * MountainBiomeHeight(global_x, global_y)
-                           + snow * SnowBiomeHeight(global_x, global_y)
-                           + grass * GrassBiomeHeight(global_x, global_y)
-                           + sand * SandBiomeHeight(global_x, global_y);
-                
-                
-               //int height = 1;
+    /**
+     * Fills in the terrain of this chunk from the columns in the given cache.
+     */
+    void generate(ColumnCache &cache) {
+        constexpr int N = WIDTH + 2;
+        Column columns[N * N];
+        cache.getColumns(location.first * WIDTH - 1, location.second * WIDTH - 1, N, N, columns);
+
+        for (int x = 0; x < WIDTH + 2; x++) {
+            for (int y = 0; y < WIDTH + 2; y++) {
+                const int global_x = x - 1 + location.first * WIDTH;
+                const int global_y = y - 1 + location.second * WIDTH;
+                const Column &column = columns[y * N + x];
+                const float noise1 = column.noise1;
+                const float noise2 = column.noise2;
+                const int height = column.height;
 
                 if (noise1 >= 0.5 && noise2 >= 0.5) {
                     float snow_height_noise = perlin2d(global_x + 4123, global_y + 6461, 0.0, 3);
                     int snow_height = 40 * snow_height_noise - 20;
-                    for (int z = 0; z <= height; z++) {
-                        if (z == height && z > Biome::SEA_LEVEL + 60 + snow_height) {
-                            blocks[x][y][z] = Block::Snow;
-                        } else if (z == height) {
-                            blocks[x][y][z] = Block::Grass;
-                        } else {
-                            blocks[x][y][z] = Block::Stone;
-                        }
+                    blocks.fillColumn(x, y, 0, height - 1, Block::Stone);
+                    if (height > Biome::SEA_LEVEL + 60 + snow_height) {
+                        blocks.fillColumn(x, y, height, height, Block::Snow);
+                    } else {
+                        blocks.fillColumn(x, y, height, height, Block::Grass);
                     }
                 } else if (noise1 >= 0.5 && noise2 <= 0.5) {
-                    for (int z = 0; z <= max(height, Biome::SEA_LEVEL); z++) {
-                        if (z > height) {
-                            blocks[x][y][z] = Block::Ice;
-                        } else if (z <= height - 4) {  
-                            blocks[x][y][z] = Block::Stone;
-                        } else if (z < height) {
-                            blocks[x][y][z] = Block::Dirt;
-                        } else {
-                            blocks[x][y][z] = Block::Snow;
-                        }
-                    }
+                    blocks.fillColumn(x, y, 0, height - 4, Block::Stone);
+                    blocks.fillColumn(x, y, height - 3, height - 1, Block::Dirt);
+                    blocks.fillColumn(x, y, height, height, Block::Snow);
+                    blocks.fillColumn(x, y, height + 1, Biome::SEA_LEVEL, Block::Ice);
                 } else if (noise1 <= 0.5 && noise2 >= 0.5) {
-                    for (int z = 0; z <= max(height, Biome::SEA_LEVEL); z++) {
-                        if (z > height) {
-                            blocks[x][y][z] = Block::Water;
-                        } else if (z <= height - 4) {  
-                            blocks[x][y][z] = Block::Stone;
-                        } else if (z < height) {
-                            blocks[x][y][z] = Block::Dirt;
-                        } else {
-                            blocks[x][y][z] = Block::Grass;
-                        }
-                    }
+                    blocks.fillColumn(x, y, 0, height - 4, Block::Stone);
+                    blocks.fillColumn(x, y, height - 3, height - 1, Block::Dirt);
+                    blocks.fillColumn(x, y, height, height, Block::Grass);
+                    blocks.fillColumn(x, y, height + 1, Biome::SEA_LEVEL, Block::Water);
                 } else if (noise1 <= 0.5 && noise2 <= 0.5) {
-                    for (int z = 0; z <= height; z++) {
-                        if (z <= height - 4) {  
-                            blocks[x][y][z] = Block::Stone;
-                        } else if (z < height) {
-                            blocks[x][y][z] = Block::Sand;
-                        } else {
-                            blocks[x][y][z] = Block::Sand;
-                        }
-                    }
+                    blocks.fillColumn(x, y, 0, height - 4, Block::Stone);
+                    blocks.fillColumn(x, y, height - 3, height, Block::Sand);
                 }
             }
         }
+        blocks.compact();
+        computeVisibility();
+    }
+
+    /**
+     * Recomputes which faces of the sections from first up to last see each
+     * other through air. Sections that are all air or hold no air at all are
+     * settled without a flood fill.
+     */
+    void computeVisibility(int first = 0, int last = SECTION_COUNT) {
+        using Occupancy = BlockStorage::Occupancy;
+        for (int s = first; s < last; s++) {
+            const Occupancy occupancy = blocks.occupancy(s);
+            if (occupancy != Occupancy::Mixed) {
+                visibility_[s] = occupancy == Occupancy::Empty ? SectionVisibility::ALL : 0;
+                continue;
+            }
+            const int z0 = s * SECTION_HEIGHT;
+            visibility_[s] = SectionVisibility::compute<WIDTH, SECTION_HEIGHT>([&](int x, int y, int z) {
+                return blocks.get(x + 1, y + 1, z0 + z) != Block::Air;
+            });
+        }
+    }
+
+    /**
+     * Returns the set of pairs of faces of the given section that see each
+     * other, as a SectionVisibility set. Every face sees every other until
+     * the blocks are generated.
+     */
+    uint16_t sectionVisibility(int section) const {
+        return visibility_[section];
     }
     
     Location getLocation() const {
@@ -304,117 +610,1053 @@ public:
     }
 
     void setModified() {
-        modified_ = true;
+        modified_ = ALL_SECTIONS;
+    }
+
+    /**
+     * Marks the given section to be remeshed, leaving the meshes of the other
+     * sections in place.
+     */
+    void setSectionModified(int section) {
+        modified_ |= 1 << section;
     }
 
+    /**
+     * Runs generate on the given pool. The chunk stays pending until the job
+     * has finished and isGenerated has observed it.
+     */
+    void scheduleGeneration(ColumnCache &cache, ThreadPool &pool, ThreadPool::Priority priority) {
+        future_blocks_ = pool.submit([this, &cache]() {
+            ScopedTrace trace("Chunk::generate");
+            const auto start = std::chrono::steady_clock::now();
+            generate(cache);
+            if (metrics_ != nullptr) {
+                metrics_->generated.add();
+                metrics_->generateTime.record(microseconds(std::chrono::steady_clock::now() - start));
+            }
+        }, std::move(priority));
+    }
+
+    /**
+     * Returns true once the blocks of this chunk have been generated. Until
+     * then the chunk is a placeholder that must not be meshed.
+     */
+    bool isGenerated() {
+        if (!generated_ && future_blocks_.valid() && is_ready(future_blocks_)) {
+            future_blocks_.get();
+            generated_ = true;
+        }
+        return generated_;
+    }
+
+    /**
+     * Replaces the blocks and section visibility of this chunk with those
+     * written by serialize and marks it generated without running the
+     * generator. Blocks stored before the visibility was stored with them
+     * are loaded too, and their visibility is computed. Returns false if the
+     * data is malformed, leaving the chunk to be generated.
+     */
+    bool load(const uint8_t *data, size_t size) {
+        const size_t blocksSize = size - sizeof(visibility_);
+        if (size >= sizeof(visibility_) && blocks.deserialize(data, blocksSize)) {
+            std::memcpy(visibility_, data + blocksSize, sizeof(visibility_));
+        } else if (blocks.deserialize(data, size)) {
+            computeVisibility();
+        } else {
+            return false;
+        }
+        generated_ = true;
+        saved_ = true;
+        return true;
+    }
+
+    /**
+     * Appends the blocks of this chunk, including its halo, followed by its
+     * section visibility to the given bytes. Storing the visibility saves
+     * flood filling every section again on load.
+     */
+    void serialize(std::vector<uint8_t> &out) const {
+        blocks.serialize(out);
+        const uint8_t *visibility = (const uint8_t*) visibility_;
+        out.insert(out.end(), visibility, visibility + sizeof(visibility_));
+    }
+
+    /**
+     * Returns true if the blocks have not changed since they were loaded or
+     * last saved.
+     */
+    bool isSaved() const {
+        return saved_;
+    }
+
+    void setSaved() {
+        saved_ = true;
+    }
+
+    /**
+     * Returns true if edits have been applied to the blocks since they were
+     * generated or loaded, so that generating them again would lose them.
+     */
+    bool isEdited() const {
+        return edited_;
+    }
+
+    /**
+     * Returns true while the chunk is being generated or meshed in the
+     * background. A busy chunk must not be destroyed.
+     */
+    bool isBusy() const {
+        return (future_blocks_.valid() && !is_ready(future_blocks_))
+            || (future_buffer_.valid() && !is_ready(future_buffer_))
+            || (future_lod_.valid() && !is_ready(future_lod_));
+    }
+
+    uint64_t lastUsed() const {
+        return last_used_;
+    }
+
+    void setLastUsed(uint64_t frame) {
+        last_used_ = frame;
+    }
+
+    /**
+     * Returns the number of bytes held by this chunk in host and device memory.
+     */
+    size_t memoryUsage() const {
+        if (!generated_) return sizeof(Chunk);
+        size_t bytes = sizeof(Chunk) - sizeof(BlockStorage) + blocks.memoryUsage();
+        for (const NativeBuffer &buffer: buffers_) {
+            bytes += buffer.memoryUsage();
+        }
+        return bytes + lod_buffer_.memoryUsage();
+    }
+
+    /**
+     * Returns true if any section is waiting to be remeshed.
+     */
     bool isModified() const {
-        return modified_;
+        return modified_ != 0;
     }
 
-   NativeBuffer* getBuffer() {
-        if (loaded_) {
-            buffer_.secondsSinceFirstLoaded_ = secondsSinceFirstLoaded();
-            return &buffer_;
+    BlockStorage::Occupancy occupancy(int section) const {
+        return blocks.occupancy(section);
+    }
+
+    /**
+     * Returns the range of heights holding any block other than air, from the
+     * bottom of the lowest such section up to the top of the highest. The
+     * range is empty if the chunk holds only air.
+     */
+    std::pair<int, int> heightBounds() const {
+        int lo = BlockStorage::SECTION_COUNT;
+        int hi = 0;
+        for (int s = 0; s < BlockStorage::SECTION_COUNT; s++) {
+            if (blocks.occupancy(s) == BlockStorage::Occupancy::Empty) continue;
+            lo = std::min(lo, s);
+            hi = s + 1;
         }
+        if (hi == 0) return {0, 0};
+        return {lo * BlockStorage::SECTION_HEIGHT, hi * BlockStorage::SECTION_HEIGHT};
+    }
+
+    /**
+     * Returns the block at the given position relative to this chunk. The x
+     * and y coordinates may range from -1 to WIDTH to read the halo copied
+     * from neighbouring chunks. Queued edits are not seen until applied.
+     */
+    uint8_t getBlock(int x, int y, int z) const {
+        return blocks.get(x + 1, y + 1, z);
+    }
+
+    /**
+     * Queues a change to the block at the given position relative to this
+     * chunk, where x and y may range from -1 to WIDTH to change the halo.
+     * Edits are applied together by applyEdits.
+     */
+    void queueEdit(int x, int y, int z, uint8_t block) {
+        edits_.push_back({(int8_t) x, (int8_t) y, (uint8_t) z, block});
+    }
+
+    bool hasEdits() const {
+        return !edits_.empty();
+    }
+
+    /**
+     * Returns the block the given position will hold once queued edits are
+     * applied. Until the chunk is generated its blocks may still be being
+     * written by a worker, so positions without an edit read as air.
+     */
+    uint8_t getEditedBlock(int x, int y, int z) {
+        for (auto it = edits_.rbegin(); it != edits_.rend(); ++it) {
+            if (it->x == x && it->y == y && it->z == z) return it->block;
+        }
+        return isGenerated() ? getBlock(x, y, z) : (uint8_t) Block::Air;
+    }
+
+    /**
+     * Applies every queued edit and marks the sections whose meshes they
+     * change, including the neighbouring section when an edit lies on a
+     * section's top or bottom layer. Returns false, leaving the edits
+     * queued, while the blocks are still being generated or meshed.
+     */
+    bool applyEdits() {
+        if (edits_.empty()) return true;
+        if (!isGenerated() || isBusy()) return false;
+
+        uint16_t changed = 0;
+        for (const Edit &edit: edits_) {
+            blocks.set(edit.x + 1, edit.y + 1, edit.z, edit.block);
+            const int section = edit.z / SECTION_HEIGHT;
+            setSectionModified(section);
+            if (edit.z % SECTION_HEIGHT == 0 && section > 0) setSectionModified(section - 1);
+            if (edit.z % SECTION_HEIGHT == SECTION_HEIGHT - 1 && section + 1 < SECTION_COUNT) setSectionModified(section + 1);
+            changed |= 1 << section;
+        }
+        edits_.clear();
+        blocks.compact();
+        for (int section = 0; section < SECTION_COUNT; section++) {
+            if (changed & (1 << section)) computeVisibility(section, section + 1);
+        }
+        saved_ = false;
+        edited_ = true;
+        lod_modified_ = true;
+        return true;
+    }
+
+    /**
+     * Returns the mesh of the given section, or nullptr if the section has no
+     * faces or has not been meshed yet. Finished meshing jobs are picked up
+     * here.
+     */
+    NativeBuffer* getBuffer(int section) {
         if (future_buffer_.valid() && is_ready(future_buffer_)) {
-            buffer_ = future_buffer_.get();
+            for (SectionMesh &mesh: future_buffer_.get()) {
+                buffers_[mesh.section] = mesh.buffer;
+            }
+            markLoaded();
             loaded_ = true;
-            buffer_.secondsSinceFirstLoaded_ = secondsSinceFirstLoaded();
-            return &buffer_;
-        } else return nullptr;
-    }
-
-    void computeBuffer(NativeDevice device) {
-        if (modified_) {
-            future_buffer_ = std::async([=]() {
-                Buffer buffer = Buffer();
-
-                for (int x = 1; x <= WIDTH; x++) {
-                    for (int y = 1; y <= WIDTH; y++) {
-                        for (int z = 0; z < HEIGHT; z++) {
-                            if (blocks[x][y][z] == Block::Air) continue;
-                            uint8_t visible_sides = 0;
-                            
-                            if (blocks[x + 1][y][z] == Block::Air) visible_sides |= Block::Right;
-                            if (blocks[x - 1][y][z] == Block::Air) visible_sides |= Block::Left;
-                            if (blocks[x][y + 1][z] == Block::Air) visible_sides |= Block::Back;
-                            if (blocks[x][y - 1][z] == Block::Air) visible_sides |= Block::Front;
-                            if (blocks[x][y][z + 1] == Block::Air) visible_sides |= Block::Top;
-                            if (blocks[x][y][z - 1] == Block::Air) visible_sides |= Block::Bottom;
-
-                            Block b{blocks[x][y][z], visible_sides};
-                            b.translate(location.first * WIDTH + x - 1, location.second * WIDTH + y - 1, z);
-                            buffer += b;
-                        }
+        }
+        NativeBuffer &buffer = buffers_[section];
+        if (!loaded_ || buffer.size() == 0) return nullptr;
+        buffer.secondsSinceFirstLoaded_ = secondsSinceFirstLoaded();
+        return &buffer;
+    }
+
+    float meshingSeconds() const {
+        return meshing_seconds_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Meshes the given section into the calling thread's arena and returns
+     * the vertices, which stay valid until the next mesh on the same thread.
+     * Sections that cannot show a face are skipped without being decoded.
+     * Otherwise the visible faces are counted first so the vertices are
+     * written into storage reserved up front and nothing is allocated once
+     * the arena has grown to fit the largest section.
+     */
+    const Buffer& mesh(MeshingMode mode, int section) const {
+        MeshArena &arena = meshArena();
+        arena.vertices.clear();
+        if (isHidden(section)) return arena.vertices;
+
+        const size_t faces = prepare(arena, section);
+        arena.vertices.reserve(faces * 4);
+        if (mode == MeshingMode::Greedy) {
+            meshGreedy(arena, section);
+        } else {
+            meshPerFace(arena, section);
+        }
+        return arena.vertices;
+    }
+
+    /**
+     * Returns the heightmap mesh of the chunk at the given level of detail,
+     * from 1 to LOD_LEVELS - 1, which stays valid until the next mesh on the
+     * same thread.
+     */
+    const Buffer& meshLod(int level) const {
+        MeshArena &arena = meshArena();
+        arena.vertices.clear();
+        meshLod(arena, level);
+        return arena.vertices;
+    }
+
+    /**
+     * Returns the level of detail last selected by selectLod.
+     */
+    int lod() const {
+        return lod_;
+    }
+
+    /**
+     * Selects the level of detail for a chunk at the given distance in
+     * chunks from the camera, where thresholds[k] is the distance beyond
+     * which level k + 1 is used. The level only changes once the distance is
+     * past a threshold by more than the hysteresis, so chunks near a
+     * threshold do not flip between levels as the camera moves.
+     */
+    int selectLod(float distance, const float (&thresholds)[LOD_LEVELS - 1], float hysteresis) {
+        while (lod_ + 1 < LOD_LEVELS && distance > thresholds[lod_] + hysteresis) lod_++;
+        while (lod_ > 0 && distance < thresholds[lod_ - 1] - hysteresis) lod_--;
+        return lod_;
+    }
+
+    /**
+     * Queues a job on the given pool that builds the heightmap mesh for the
+     * selected level of detail, unless it is already built and the blocks
+     * have not changed since, or a previous job is still in flight.
+     */
+    void computeLod(NativeDevice device, ThreadPool &pool, ThreadPool::Priority priority) {
+        if (lod_ == 0 || future_lod_.valid() || (lod_buffer_level_ == lod_ && !lod_modified_)) return;
+
+        const int level = lod_;
+        future_lod_ = pool.submit([=]() {
+            ScopedTrace trace("Chunk::meshLod");
+            const Buffer &buffer = meshLod(level);
+            if (metrics_ != nullptr) metrics_->heightmapsMeshed.add();
+            NativeBuffer native;
+            if (buffer.size() > 0) {
+                native = NativeBuffer(device, buffer.size(), {location.first * WIDTH, location.second * WIDTH, 0});
+                native.fill(buffer);
+            }
+            return native;
+        }, std::move(priority));
+        future_lod_level_ = level;
+        lod_modified_ = false;
+    }
+
+    /**
+     * Returns the heightmap mesh, or nullptr if none has been built or it
+     * has no faces. A finished job is picked up here, so the mesh may be of
+     * another level than the selected one until the job for that level is
+     * done.
+     */
+    NativeBuffer* getLodBuffer() {
+        if (future_lod_.valid() && is_ready(future_lod_)) {
+            lod_buffer_ = future_lod_.get();
+            lod_buffer_level_ = future_lod_level_;
+            markLoaded();
+        }
+        if (lod_buffer_level_ == 0 || lod_buffer_.size() == 0) return nullptr;
+        lod_buffer_.secondsSinceFirstLoaded_ = secondsSinceFirstLoaded();
+        return &lod_buffer_;
+    }
+
+    /**
+     * Returns the level of the heightmap mesh returned by getLodBuffer, or 0
+     * if there is none.
+     */
+    int lodBufferLevel() const {
+        return lod_buffer_level_;
+    }
+
+    /**
+     * Returns true once the section meshes have been built and picked up by
+     * getBuffer.
+     */
+    bool hasSections() const {
+        return loaded_;
+    }
+
+    /**
+     * Returns true while a meshing job of this chunk is queued or running.
+     */
+    bool isMeshing() const {
+        return (future_buffer_.valid() && !is_ready(future_buffer_))
+            || (future_lod_.valid() && !is_ready(future_lod_));
+    }
+
+    /**
+     * Returns the number of vertices in the meshes of this chunk.
+     */
+    size_t vertexCount() const {
+        size_t count = lod_buffer_.size();
+        for (const NativeBuffer &buffer: buffers_) {
+            count += buffer.size();
+        }
+        return count;
+    }
+
+    /**
+     * Sets the metrics this chunk reports generation, meshing and how long
+     * it took to become visible to. Must be called before any job of the
+     * chunk is scheduled.
+     */
+    void setMetrics(ChunkMetrics *metrics) {
+        metrics_ = metrics;
+    }
+
+    /**
+     * Frees the section meshes of a chunk drawn with a heightmap, marking
+     * every section to be remeshed if it is drawn in full again. Does
+     * nothing while sections are being meshed.
+     */
+    void releaseSections() {
+        if (future_buffer_.valid() || !loaded_) return;
+        for (NativeBuffer &buffer: buffers_) {
+            buffer = NativeBuffer();
+        }
+        loaded_ = false;
+        modified_ = ALL_SECTIONS;
+    }
+
+    /**
+     * Frees the heightmap mesh of a chunk drawn in full, discarding a job
+     * still building one once it finishes.
+     */
+    void releaseLod() {
+        if (future_lod_.valid()) {
+            if (!is_ready(future_lod_)) return;
+            future_lod_.get();
+        }
+        lod_buffer_ = NativeBuffer();
+        lod_buffer_level_ = 0;
+    }
+
+    /**
+     * Returns the key the mesh of the given section is cached under, which
+     * covers the blocks of the section and of the sections above and below
+     * it that the mesher reads.
+     */
+    MeshKey meshKey(MeshingMode mode, int section) const {
+        return {location, section, blocks.hash(section - 1, section + 2), MESHER_VERSION << 1 | (uint32_t) mode};
+    }
+
+    /**
+     * Meshes every section that can show a face into the given cache, reusing
+     * meshes already cached for the same blocks, and returns the number of
+     * vertices in them. Safe to call from any thread while the blocks do not
+     * change.
+     */
+    size_t cacheMeshes(MeshCache &cache, MeshingMode mode) const {
+        size_t vertices = 0;
+        for (int section = 0; section < SECTION_COUNT; section++) {
+            if (isHidden(section)) continue;
+            const MeshKey key = meshKey(mode, section);
+            if (cache.find(key, [&](const Vertex*, size_t count) { vertices += count; })) continue;
+            const Buffer &buffer = mesh(mode, section);
+            vertices += buffer.size();
+            cache.store(key, buffer);
+        }
+        return vertices;
+    }
+
+    /**
+     * Queues a job on the given pool that remeshes every modified section,
+     * unless the previous job has not been picked up by getBuffer yet. The
+     * other sections keep their meshes. The job runs in order of the given
+     * priority. With a cache, meshes of sections whose blocks are unchanged
+     * are copied from it instead of being rebuilt, and rebuilt meshes are
+     * stored in it.
+     */
+    void computeBuffer(NativeDevice device, ThreadPool &pool, ThreadPool::Priority priority, MeshingMode mode = MeshingMode::Greedy, MeshCache *cache = nullptr) {
+        if (modified_ == 0 || future_buffer_.valid()) return;
+
+        const uint16_t sections = modified_;
+        future_buffer_ = pool.submit([=]() {
+            ScopedTrace trace("Chunk::meshSections");
+            auto start = std::chrono::steady_clock::now();
+            const simd::int3 origin = {location.first * WIDTH, location.second * WIDTH, 0};
+            std::vector<SectionMesh> meshes;
+            size_t meshed = 0;
+            size_t vertices = 0;
+            for (int section = 0; section < SECTION_COUNT; section++) {
+                if (!(sections & (1 << section))) continue;
+                NativeBuffer native;
+                if (isHidden(section)) {
+                    meshes.push_back({section, native});
+                    continue;
+                }
+
+                const MeshKey key = meshKey(mode, section);
+                const bool hit = cache != nullptr && cache->find(key, [&](const Vertex *vertices, size_t count) {
+                    if (count == 0) return;
+                    native = NativeBuffer(device, count, origin);
+                    native.fill(vertices, count);
+                });
+                if (!hit) {
+                    const Buffer &buffer = mesh(mode, section);
+                    if (buffer.size() > 0) {
+                        native = NativeBuffer(device, buffer.size(), origin);
+                        native.fill(buffer);
                     }
+                    if (cache != nullptr) cache->store(key, buffer);
                 }
-                NativeBuffer buffer_ = NativeBuffer(device, buffer.size());
-                buffer_.fill(buffer);
-                loaded_time_ = std::chrono::steady_clock::now();
-                return buffer_;
-            });
-            
-            modified_ = false;
-        }
+                meshes.push_back({section, native});
+                meshed++;
+                vertices += native.size();
+            }
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            meshing_seconds_.store(std::chrono::duration<float>(elapsed).count(), std::memory_order_relaxed);
+            if (metrics_ != nullptr) {
+                metrics_->sectionsMeshed.add(meshed);
+                metrics_->verticesMeshed.add(vertices);
+                metrics_->meshTime.record(microseconds(elapsed));
+            }
+            return meshes;
+        }, std::move(priority));
+
+        modified_ = 0;
     }
 };
 
 class World {
-private:
+public:
 
-    struct hash {
-        size_t operator()(const Chunk::Location& loc) const{
-            auto hash1 = std::hash<int>{}(loc.first);
-            auto hash2 = std::hash<int>{}(loc.second);
-            return hash1 ^ hash2;
-        }
+    /**
+     * LeastRecentlyUsed evicts the chunks that have been out of render
+     * distance the longest. Distance evicts the chunks furthest from the
+     * camera first.
+     */
+    enum class EvictionPolicy {
+        LeastRecentlyUsed,
+        Distance
     };
 
-    std::unordered_map<Chunk::Location, Chunk, hash> chunks;
+private:
+
+    /**
+     * Locations of evicted chunks are remembered to count reloads. The set is
+     * cleared once it reaches this size, so reloads of chunks evicted long
+     * ago may go uncounted.
+     */
+    static constexpr size_t MAX_EVICTED_LOCATIONS = 1 << 16;
+
+    MetricsRegistry metrics_;
+    ChunkMetrics chunkMetrics_{metrics_};
+    Counter &requested_ = metrics_.counter("world.chunks_requested");
+    Counter &stored_ = metrics_.counter("world.chunks_loaded_from_storage");
+    Counter &saved_ = metrics_.counter("world.chunks_saved");
+    Counter &evictions_ = metrics_.counter("world.chunks_evicted");
+    Counter &saveFailures_ = metrics_.counter("world.chunk_save_failures");
+    Counter &unsavedSkips_ = metrics_.counter("world.evictions_skipped_unsaved");
+    Counter &reloads_ = metrics_.counter("world.chunks_reloaded");
+    Gauge &resident_ = metrics_.gauge("world.chunks");
+    Gauge &generating_ = metrics_.gauge("world.chunks_generating");
+    Gauge &meshing_ = metrics_.gauge("world.chunks_meshing");
+    Gauge &loaded_ = metrics_.gauge("world.chunks_loaded");
+    Gauge &modified_ = metrics_.gauge("world.chunks_modified");
+    Gauge &vertices_ = metrics_.gauge("world.vertices");
+    Gauge &bytes_ = metrics_.gauge("world.bytes");
+
+    ChunkMap<Chunk> chunks;
     std::vector<PlayerCamera> players;
+    ColumnCache columns_;
+    size_t memory_budget_ = 256 << 20;
+    int eviction_margin_ = 2;
+    EvictionPolicy eviction_policy_ = EvictionPolicy::LeastRecentlyUsed;
+    std::unordered_set<Chunk::Location, LocationHash> evicted_;
+    uint64_t frame_ = 0;
+    ChunkGrid<Chunk> grid_;
+    std::vector<Chunk*> edited_;
+    std::unique_ptr<RegionStore> storage_;
+    std::unique_ptr<MeshCache> meshes_;
+
+    // Declared last so that the workers are stopped before any chunk they
+    // reference is destroyed.
+    ThreadPool pool_;
     
 public:
 
-    World() {
+    World(size_t workers = ThreadPool::defaultWorkerCount()): pool_{workers} {
         PlayerCamera camera(0, 0, Biome::SEA_LEVEL + 50, 0);
         players.push_back(camera);
     }
 
+    ~World() {
+        save();
+    }
+
     bool isChunkGenerated(Chunk::Location loc) const {
-        auto it = chunks.find(loc);
-        return it != chunks.end();
+        return chunks.get(loc) != nullptr;
     }
 
+    /**
+     * Adds a chunk at the given location, loading its blocks from storage if
+     * they were saved and otherwise scheduling its generation in the
+     * background.
+     */
     Chunk* generateChunk(Chunk::Location loc) {
-        auto it = chunks.emplace(loc, Chunk(loc)).first;
-        return &it->second;
+        ScopedTrace trace("World::generateChunk");
+        if (evicted_.erase(loc)) reloads_.add();
+        requested_.add();
+        Chunk *chunk = chunks.insert(loc, std::unique_ptr<Chunk>(new Chunk(loc)));
+        chunk->setMetrics(&chunkMetrics_);
+        if (loadChunk(*chunk)) {
+            stored_.add();
+        } else {
+            chunk->scheduleGeneration(columns_, pool_, priority(loc));
+        }
+        return chunk;
+    }
+
+    /**
+     * Stores chunks in region files in the given directory. Chunks found
+     * there are loaded instead of generated, and generated or edited chunks
+     * are written back when they are evicted or saved. Section meshes are
+     * cached in a subdirectory. Returns false if the directory does not
+     * exist and could not be created.
+     */
+    bool setStorage(const std::string &directory) {
+        storage_.reset(new RegionStore(directory));
+        meshes_.reset(new MeshCache(directory + "/meshes", Chunk::SECTION_COUNT));
+        return storage_->isAvailable();
+    }
+
+    /**
+     * Returns the cache of section meshes, or nullptr without storage.
+     */
+    MeshCache* meshCache() {
+        return meshes_.get();
+    }
+
+    /**
+     * Loads the blocks of the given chunk from storage. Returns false if
+     * there is no storage or the chunk is not stored in it.
+     */
+    bool loadChunk(Chunk &chunk) {
+        if (!storage_) return false;
+        size_t length = 0;
+        const uint8_t *data = storage_->read(chunk.getLocation(), length);
+        return data != nullptr && chunk.load(data, length);
+    }
+
+    /**
+     * Writes the blocks of the given chunk to storage if they have changed
+     * since they were loaded or last saved. Chunks still being generated are
+     * skipped. Returns true if the chunk is saved afterwards, and false if
+     * there is no storage or the write failed.
+     */
+    bool saveChunk(Chunk &chunk) {
+        if (chunk.isSaved()) return true;
+        if (!storage_ || !chunk.isGenerated()) return false;
+        std::vector<uint8_t> bytes;
+        chunk.serialize(bytes);
+        if (!storage_->write(chunk.getLocation(), bytes)) {
+            saveFailures_.add();
+            return false;
+        }
+        chunk.setSaved();
+        saved_.add();
+        return true;
+    }
+
+    /**
+     * The PregenerationStats struct reports the progress of pregenerate.
+     * Chunks counts the chunks written to storage and failed those that could
+     * not be. The generate, mesh and serialize times are summed over the
+     * workers, while write time is spent on the calling thread.
+     */
+    struct PregenerationStats {
+        size_t chunks = 0;
+        size_t skipped = 0;
+        size_t failed = 0;
+        size_t vertices = 0;
+        size_t bytes = 0;
+        double generateSeconds = 0.0;
+        double meshSeconds = 0.0;
+        double serializeSeconds = 0.0;
+        double writeSeconds = 0.0;
+        double seconds = 0.0;
+    };
+
+    /**
+     * Generates and meshes the chunks at the given locations on the worker
+     * pool and writes their blocks and meshes to storage, without loading
+     * them into the world. Chunks that are already stored or loaded are
+     * skipped. At most a few chunks per worker are in flight at once, so
+     * memory stays bounded however large the area is, and locations are
+     * handed out in the given order so neighbouring chunks share cached
+     * columns. The given function, if any, is called after every chunk.
+     */
+    PregenerationStats pregenerate(const std::vector<Chunk::Location> &locations, Chunk::MeshingMode mode = Chunk::MeshingMode::Greedy,
+                                   std::function<void(const PregenerationStats&)> progress = nullptr) {
+        struct Result {
+            Chunk::Location location;
+            std::vector<uint8_t> bytes;
+            size_t vertices;
+            double generateSeconds;
+            double meshSeconds;
+            double serializeSeconds;
+        };
+
+        using clock = std::chrono::steady_clock;
+        auto seconds = [](clock::time_point start) {
+            return std::chrono::duration<double>(clock::now() - start).count();
+        };
+
+        PregenerationStats stats;
+        const auto start = clock::now();
+        const size_t window = pool_.workerCount() * 4;
+        std::deque<std::future<Result>> jobs;
+
+        auto collect = [&]() {
+            Result result = jobs.front().get();
+            jobs.pop_front();
+            const auto write = clock::now();
+            const bool written = storage_ && storage_->write(result.location, result.bytes);
+            stats.writeSeconds += seconds(write);
+            if (written) {
+                stats.chunks++;
+            } else {
+                stats.failed++;
+            }
+            stats.vertices += result.vertices;
+            stats.bytes += result.bytes.size();
+            stats.generateSeconds += result.generateSeconds;
+            stats.meshSeconds += result.meshSeconds;
+            stats.serializeSeconds += result.serializeSeconds;
+            stats.seconds = seconds(start);
+            if (progress) progress(stats);
+        };
+
+        MeshCache *cache = meshes_.get();
+        for (size_t i = 0; i < locations.size(); i++) {
+            const Chunk::Location loc = locations[i];
+            size_t length = 0;
+            if (chunks.get(loc) != nullptr || (storage_ && storage_->read(loc, length) != nullptr)) {
+                stats.skipped++;
+                continue;
+            }
+
+            jobs.push_back(pool_.submit([this, loc, mode, cache, seconds]() {
+                Result result = {loc, {}, 0, 0.0, 0.0, 0.0};
+                std::unique_ptr<Chunk> chunk(new Chunk(loc));
+
+                auto stage = clock::now();
+                chunk->generate(columns_);
+                result.generateSeconds = seconds(stage);
+
+                stage = clock::now();
+                if (cache != nullptr) {
+                    result.vertices = chunk->cacheMeshes(*cache, mode);
+                } else {
+                    for (int section = 0; section < Chunk::SECTION_COUNT; section++) {
+                        result.vertices += chunk->mesh(mode, section).size();
+                    }
+                }
+                result.meshSeconds = seconds(stage);
+
+                stage = clock::now();
+                chunk->serialize(result.bytes);
+                result.serializeSeconds = seconds(stage);
+                return result;
+            }, [i]() { return (float) i; }));
+
+            if (jobs.size() >= window) collect();
+        }
+        while (!jobs.empty()) collect();
+
+        stats.seconds = seconds(start);
+        return stats;
+    }
+
+    /**
+     * Applies queued edits and saves every changed chunk. Edits to chunks
+     * that are busy stay queued and are not saved.
+     */
+    void save() {
+        if (!storage_) return;
+        applyEdits();
+        for (auto it: chunks) {
+            saveChunk(it.second);
+        }
     }
 
     PlayerCamera& playerCamera() {
         return players[0];
     }
 
+    static int floorDiv(int a, int b) {
+        return a / b - (a % b != 0 && (a < 0) != (b < 0));
+    }
+
+    /**
+     * Returns the location of the chunk holding the camera. The block at an
+     * integer position spans half a block either side of it.
+     */
+    Chunk::Location cameraLocation() {
+        const int a = floorDiv((int) std::floor(playerCamera().x() + 0.5f), Chunk::WIDTH);
+        const int b = floorDiv((int) std::floor(playerCamera().y() + 0.5f), Chunk::WIDTH);
+        return {a, b};
+    }
+
+    /**
+     * Returns the section holding the camera, clamped to the sections of a
+     * chunk.
+     */
+    int cameraSection() {
+        const int section = floorDiv((int) std::floor(playerCamera().z() + 0.5f), Chunk::SECTION_HEIGHT);
+        return std::min(std::max(section, 0), Chunk::SECTION_COUNT - 1);
+    }
+
+    ColumnCache& columnCache() {
+        return columns_;
+    }
+
+    ThreadPool& threadPool() {
+        return pool_;
+    }
+
+    /**
+     * Returns the priority of work on the chunk at the given location, which
+     * is its squared distance in blocks from the camera at the time the
+     * priority is evaluated.
+     */
+    ThreadPool::Priority priority(Chunk::Location loc) {
+        return [this, loc]() {
+            const float dx = (loc.first + 0.5f) * Chunk::WIDTH - playerCamera().x();
+            const float dy = (loc.second + 0.5f) * Chunk::WIDTH - playerCamera().y();
+            return dx * dx + dy * dy;
+        };
+    }
+
+    void setAllModified() {
+        for (auto it: chunks) {
+            it.second.setModified();
+        }
+    }
+
     Chunk* getChunk(Chunk::Location loc) {
-        auto it = chunks.find(loc);
-        if (it == chunks.end()) {
-            return generateChunk(loc);
-        } else return &it->second;
+        if (Chunk *chunk = grid_.get(loc)) return chunk;
+        if (Chunk *chunk = chunks.get(loc)) return chunk;
+        return generateChunk(loc);
     }
 
-    std::vector<Chunk*> getChunksWithinRenderDistance(int d = 4) {
-        std::vector<Chunk*> chunks;
+    /**
+     * Returns the chunks within d chunks of the camera. The set is kept in a
+     * grid centered on the camera and only changes when the camera crosses
+     * into another chunk. Chunks leaving it are stamped with the current
+     * frame, so that least recently used eviction sees how long they have
+     * been out of render distance.
+     */
+    const std::vector<Chunk*>& getChunksWithinRenderDistance(int d = 4) {
+        ScopedTrace trace("World::getChunksWithinRenderDistance");
+        const Chunk::Location location = cameraLocation();
+        frame_++;
+
+        if (grid_.center() != location || grid_.radius() != d) {
+            pool_.reprioritize();
+            grid_.update(location, d, [this](Chunk::Location loc) {
+                return getChunk(loc);
+            }, [this](Chunk *chunk) {
+                chunk->setLastUsed(frame_);
+            });
+        }
+        return grid_.items();
+    }
 
-        int a = (int) playerCamera().x() / Chunk::WIDTH;
-        int b = (int) playerCamera().y() / Chunk::WIDTH;
+    /**
+     * Returns the chunk neighbouring the given location within render
+     * distance, or nullptr if it is not within render distance.
+     */
+    Chunk* getNeighbour(Chunk::Location loc, int dx, int dy) const {
+        return grid_.neighbour(loc, dx, dy);
+    }
 
-        for (int i = -d; i <= d; i++) {
-            for (int j = -d; j <= d; j++) {
-                if (i * i + j * j <= d * d) {
-                    chunks.push_back(getChunk({i + a, j + b}));
-                }
+    /**
+     * The BlockEdit struct is one change of a batch passed to setBlocks, at a
+     * position in world block coordinates.
+     */
+    struct BlockEdit {
+        int x;
+        int y;
+        int z;
+        uint8_t block;
+    };
+
+    /**
+     * Queues a change to the block at the given world position, loading its
+     * chunk if necessary. The edit is copied into the owning chunk and into
+     * the halo of every neighbour bordering it, and takes effect when
+     * applyEdits next runs. Heights outside the world are ignored.
+     */
+    void setBlock(int x, int y, int z, uint8_t block) {
+        if (z < 0 || z >= Chunk::HEIGHT) return;
+        const int a = floorDiv(x, Chunk::WIDTH);
+        const int b = floorDiv(y, Chunk::WIDTH);
+        const int lx = x - a * Chunk::WIDTH;
+        const int ly = y - b * Chunk::WIDTH;
+
+        for (int i = -1; i <= 1; i++) {
+            for (int j = -1; j <= 1; j++) {
+                const int cx = lx - i * Chunk::WIDTH;
+                const int cy = ly - j * Chunk::WIDTH;
+                if (cx < -1 || cx > Chunk::WIDTH || cy < -1 || cy > Chunk::WIDTH) continue;
+                Chunk *chunk = getChunk({a + i, b + j});
+                if (!chunk->hasEdits()) edited_.push_back(chunk);
+                chunk->queueEdit(cx, cy, z, block);
+            }
+        }
+    }
+
+    /**
+     * Queues a batch of edits. All of them are applied by the same call to
+     * applyEdits, so each affected section is remeshed once.
+     */
+    void setBlocks(const std::vector<BlockEdit> &edits) {
+        for (const BlockEdit &edit: edits) {
+            setBlock(edit.x, edit.y, edit.z, edit.block);
+        }
+    }
+
+    /**
+     * Returns the block at the given world position, including queued edits.
+     * Positions in chunks that have not been generated read as air.
+     */
+    uint8_t getBlock(int x, int y, int z) {
+        if (z < 0 || z >= Chunk::HEIGHT) return Block::Air;
+        const int a = floorDiv(x, Chunk::WIDTH);
+        const int b = floorDiv(y, Chunk::WIDTH);
+        Chunk *chunk = grid_.get({a, b});
+        if (chunk == nullptr) chunk = chunks.get({a, b});
+        if (chunk == nullptr) return Block::Air;
+        return chunk->getEditedBlock(x - a * Chunk::WIDTH, y - b * Chunk::WIDTH, z);
+    }
+
+    /**
+     * Applies the queued edits of every chunk that is not being generated or
+     * meshed. Chunks that are busy keep their edits for a later call.
+     */
+    void applyEdits() {
+        edited_.erase(std::remove_if(edited_.begin(), edited_.end(), [](Chunk *chunk) {
+            return chunk->applyEdits();
+        }), edited_.end());
+    }
+
+    /**
+     * Sets the number of bytes of host and device memory that loaded chunks
+     * may use before chunks outside of render distance are evicted.
+     */
+    void setMemoryBudget(size_t bytes) {
+        memory_budget_ = bytes;
+    }
+
+    size_t memoryBudget() const {
+        return memory_budget_;
+    }
+
+    /**
+     * Sets the number of chunks beyond render distance that a chunk must be
+     * before it may be evicted, so that chunks at the edge of render distance
+     * are not reloaded as the camera moves back and forth.
+     */
+    void setEvictionMargin(int chunks) {
+        eviction_margin_ = chunks;
+    }
+
+    void setEvictionPolicy(EvictionPolicy policy) {
+        eviction_policy_ = policy;
+    }
+
+    size_t memoryUsage() const {
+        size_t bytes = 0;
+        for (auto it: chunks) {
+            bytes += it.second.memoryUsage();
+        }
+        return bytes;
+    }
+
+    size_t chunkCount() const {
+        return chunks.size();
+    }
+
+    size_t evictionCount() const {
+        return evictions_.value();
+    }
+
+    size_t reloadCount() const {
+        return reloads_.value();
+    }
+
+    /**
+     * Returns the metrics of this world, its chunks and the engine drawing
+     * them.
+     */
+    MetricsRegistry& metrics() {
+        return metrics_;
+    }
+
+    /**
+     * Sets the gauges counting chunks in each state of their lifecycle and
+     * the vertices and bytes they hold. Walks every loaded chunk.
+     */
+    void updateMetrics() {
+        int64_t generating = 0, meshing = 0, loaded = 0, modified = 0, vertices = 0, bytes = 0;
+        for (auto it: chunks) {
+            Chunk &chunk = it.second;
+            if (!chunk.isGenerated()) {
+                generating++;
+                continue;
+            }
+            if (chunk.isMeshing()) meshing++;
+            if (chunk.hasSections() || chunk.lodBufferLevel() > 0) loaded++;
+            if (chunk.lod() == 0 && chunk.isModified()) modified++;
+            vertices += chunk.vertexCount();
+            bytes += chunk.memoryUsage();
+        }
+        resident_.set(chunks.size());
+        generating_.set(generating);
+        meshing_.set(meshing);
+        loaded_.set(loaded);
+        modified_.set(modified);
+        vertices_.set(vertices);
+        bytes_.set(bytes);
+    }
+
+    /**
+     * Evicts chunks further than the given render distance plus the eviction
+     * margin until memory usage is within budget. Chunks with a mesh in flight
+     * are skipped and considered again on a later call, as are chunks that
+     * could not be saved, so that a failed write never loses edits.
+     */
+    void evictChunks(int d) {
+        int a, b; std::tie(a, b) = cameraLocation();
+        const int r = d + eviction_margin_;
+
+        struct Candidate {
+            Chunk::Location location;
+            uint64_t key;
+            size_t bytes;
+        };
+        std::vector<Candidate> candidates;
+        size_t usage = 0;
+
+        for (auto it: chunks) {
+            const Chunk &chunk = it.second;
+            const size_t bytes = chunk.memoryUsage();
+            usage += bytes;
+
+            const int i = it.first.first - a;
+            const int j = it.first.second - b;
+            if (i * i + j * j <= r * r || chunk.isBusy() || chunk.hasEdits() || grid_.contains(it.first)) continue;
+
+            uint64_t key = eviction_policy_ == EvictionPolicy::LeastRecentlyUsed
+                ? chunk.lastUsed()
+                : UINT64_MAX - (uint64_t) (i * i + j * j);
+            candidates.push_back({it.first, key, bytes});
+        }
+
+        if (usage <= memory_budget_) return;
+
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate &x, const Candidate &y) {
+            return x.key < y.key;
+        });
+
+        if (evicted_.size() >= MAX_EVICTED_LOCATIONS) evicted_.clear();
+
+        for (const Candidate &candidate: candidates) {
+            if (usage <= memory_budget_) break;
+            Chunk &chunk = *chunks.get(candidate.location);
+            if (!saveChunk(chunk) && (storage_ || chunk.isEdited())) {
+                unsavedSkips_.add();
+                continue;
             }
+            chunks.erase(candidate.location);
+            evicted_.insert(candidate.location);
+            usage -= candidate.bytes;
+            evictions_.add();
         }
-        return chunks;
     }
     
 };
@@ -423,71 +1665,299 @@ class GameEngine {
 public:
 
 private:
-    NativeDevice device_;
+    NativeDevice device_ = nullptr;
+    NativeIndexBuffer indices_;
     World world_;
-    std::function<void(const std::vector<NativeBuffer> &buffers)> draw_;
+    Counter &frames_ = world_.metrics().counter("frame.count");
+    Histogram &frameTime_ = world_.metrics().histogram("frame.render_us");
+    Gauge &frameVertices_ = world_.metrics().gauge("frame.vertices");
+    Gauge &frameDraws_ = world_.metrics().gauge("frame.draws");
+    Gauge &frameCulled_ = world_.metrics().gauge("frame.chunks_culled");
+    Gauge &frameOccluded_ = world_.metrics().gauge("frame.occluded");
+    std::chrono::steady_clock::time_point metricsTime_;
+    Simulation simulation_{world_.playerCamera()};
+    RenderBackend *backend_ = nullptr;
+    DrawList drawList_;
+    Chunk::MeshingMode meshingMode_ = Chunk::MeshingMode::Greedy;
+    size_t vertexCount_ = 0;
+    size_t culledCount_ = 0;
+    size_t culledSectionCount_ = 0;
+    size_t drawnCount_ = 0;
+    size_t occludedCount_ = 0;
+    size_t lodCounts_[Chunk::LOD_LEVELS] = {};
+    int renderDistance_ = 32;
+    float lodDistances_[Chunk::LOD_LEVELS - 1] = {5, 10, 16};
+    bool occlusionCulling_ = true;
+
+    /**
+     * One step of the flood fill through the visibility graph: a section at
+     * a location relative to the camera's chunk, the face it was entered
+     * through, or -1 for the camera's own section, and the set of directions
+     * taken to reach it.
+     */
+    struct VisibilityStep {
+        int x;
+        int y;
+        int section;
+        int from;
+        uint8_t directions;
+    };
 
-    bool forwards = false;
-    bool backwards = false;
-    bool left = false;
-    bool right = false;
-    bool up = false;
-    bool down = false;
+    std::vector<VisibilityStep> visibilitySteps_;
+    std::vector<uint16_t> reachable_;
 
 public:
 
+    GameEngine(size_t workers = ThreadPool::defaultWorkerCount()): world_{workers} {}
+
     PlayerCamera& playerCamera() {
         return world_.playerCamera();
     }    
 
+    /**
+     * Sets the device meshes are uploaded to, building the shared index buffer
+     * on it the first time the device changes.
+     */
     void setDevice(NativeDevice device) {
+        if (device == device_) return;
         device_ = device;
+        indices_ = NativeIndexBuffer(device, Chunk::MAX_QUADS);
+    }
+
+    /**
+     * Returns the index buffer drawing the quads of any section or heightmap
+     * mesh.
+     */
+    const NativeIndexBuffer& indexBuffer() const {
+        return indices_;
+    }
+
+    Chunk::MeshingMode meshingMode() const {
+        return meshingMode_;
+    }
+
+    /**
+     * Switches the mesher used for all chunks and remeshes everything that is
+     * already loaded so the two modes can be compared side by side.
+     */
+    void setMeshingMode(Chunk::MeshingMode mode) {
+        if (mode == meshingMode_) return;
+        meshingMode_ = mode;
+        world_.setAllModified();
+    }
+
+    /**
+     * Stores the world in region files in the given directory.
+     */
+    void setStorage(const std::string &directory) {
+        world_.setStorage(directory);
+    }
+
+    /**
+     * Writes every changed chunk to storage.
+     */
+    void save() {
+        world_.save();
+    }
+
+    /**
+     * The distance in chunks by which a chunk must pass a level of detail
+     * threshold before it switches level.
+     */
+    static constexpr float LOD_HYSTERESIS = 1.0f;
+
+    int renderDistance() const {
+        return renderDistance_;
+    }
+
+    /**
+     * Sets the distance in chunks within which chunks are loaded and drawn.
+     */
+    void setRenderDistance(int chunks) {
+        renderDistance_ = chunks;
+    }
+
+    /**
+     * Sets the distances in chunks beyond which chunks are drawn with
+     * heightmap meshes with cells 2, 4 and 8 columns wide.
+     */
+    void setLodDistances(float half, float quarter, float eighth) {
+        lodDistances_[0] = half;
+        lodDistances_[1] = quarter;
+        lodDistances_[2] = eighth;
+    }
+
+    /**
+     * Returns the number of chunks drawn at the given level of detail in the
+     * last frame.
+     */
+    size_t lodCount(int level) const {
+        return lodCounts_[level];
+    }
+
+    /**
+     * The interval in milliseconds at which render refreshes the gauges of
+     * the chunk lifecycle, which walk every loaded chunk.
+     */
+    static constexpr int METRICS_INTERVAL_MS = 100;
+
+    /**
+     * Turns the camera by the given angle in degrees at the next simulation
+     * tick.
+     */
+    void rotateCamera(float dtheta) {
+        simulation_.rotate(dtheta);
+    }
+
+    /**
+     * Moves the camera to the given position and heading at once.
+     */
+    void setCamera(const CameraState &state) {
+        simulation_.reset(state);
+        playerCamera().setPosition(state.x, state.y, state.z);
+        playerCamera().setTheta(state.theta);
+    }
+
+    Simulation& simulation() {
+        return simulation_;
+    }
+
+    /**
+     * Returns the metrics of the engine and its world. Snapshots may be taken
+     * from any thread while the engine renders.
+     */
+    MetricsRegistry& metrics() {
+        return world_.metrics();
+    }
+
+    /**
+     * Returns the fraction of section meshes found in the mesh cache instead
+     * of being rebuilt, or zero without storage.
+     */
+    float meshCacheHitRate() {
+        MeshCache *cache = world_.meshCache();
+        return cache == nullptr ? 0.0f : cache->hitRate();
+    }
+
+    /**
+     * The number of vertices submitted by the last call to render.
+     */
+    size_t vertexCount() const {
+        return vertexCount_;
+    }
+
+    /**
+     * Returns the number of meshed chunks within render distance that were
+     * skipped in the last frame for lying outside the view frustum.
+     */
+    size_t culledCount() const {
+        return culledCount_;
+    }
+
+    /**
+     * Returns the number of sections of chunks inside the view frustum that
+     * were skipped in the last frame for lying outside it themselves.
+     */
+    size_t culledSectionCount() const {
+        return culledSectionCount_;
+    }
+
+    /**
+     * Returns the number of section buffers and heightmap meshes inside the
+     * view frustum that were skipped in the last frame because no path of
+     * air leads to them from the camera.
+     */
+    size_t occludedCount() const {
+        return occludedCount_;
+    }
+
+    bool occlusionCulling() const {
+        return occlusionCulling_;
+    }
+
+    /**
+     * Enables or disables skipping sections that the visibility graph shows
+     * to be hidden behind terrain.
+     */
+    void setOcclusionCulling(bool enabled) {
+        occlusionCulling_ = enabled;
+    }
+
+    /**
+     * Returns the number of section buffers drawn in the last frame.
+     */
+    size_t drawnCount() const {
+        return drawnCount_;
+    }
+
+    /**
+     * Returns true if any part of the given chunk between heights z0 and z1
+     * may be inside the view frustum. The box is taken relative to the camera
+     * and with its y and z axes swapped, matching the space of the camera
+     * matrix.
+     */
+    bool isVisible(const Frustum &frustum, Chunk::Location location, int z0, int z1) {
+        if (z0 == z1) return false;
+        const PlayerCamera &camera = playerCamera();
+        const float x = location.first * Chunk::WIDTH - 0.5f - camera.x();
+        const float y = location.second * Chunk::WIDTH - 0.5f - camera.y();
+        const simd::float3 lo = {x, z0 - 0.5f - camera.z(), y};
+        const simd::float3 hi = {x + Chunk::WIDTH, z1 - 0.5f - camera.z(), y + Chunk::WIDTH};
+        return frustum.intersects(lo, hi);
     }
 
-    void setDrawFunction(std::function<void(const std::vector<NativeBuffer> &buffers)> draw) {
-        draw_ = draw;
+    /**
+     * Sets the backend each frame's draw list is issued to.
+     */
+    void setBackend(RenderBackend *backend) {
+        backend_ = backend;
+    }
+
+    /**
+     * Returns the draw list of the last frame.
+     */
+    const DrawList& drawList() const {
+        return drawList_;
+    }
+
+    /**
+     * Returns the simulated movement key bound to the given character, or 0
+     * if there is none.
+     */
+    static uint8_t movementKey(char c) {
+        switch (c) {
+        case 'w':
+            return Simulation::Forwards;
+        case 'a':
+            return Simulation::Left;
+        case 's':
+            return Simulation::Backwards;
+        case 'd':
+            return Simulation::Right;
+        case 'z':
+            return Simulation::Up;
+        case 'x':
+            return Simulation::Down;
+        default:
+            return 0;
+        }
     }
 
     bool onKeyPress(char c) {
-        if (c == 'w') {
-            forwards = true;
+        if (const uint8_t key = movementKey(c)) {
+            simulation_.setInput((Simulation::Input) key, true);
             return true;
-        } else if (c == 'a') {
-            left = true;
-            return true;
-        } else if (c == 's') {
-            backwards = true;
-            return true;
-        } else if (c == 'd') {
-            right = true;
-            return true;
-        } else if (c == 'z') {
-            up = true;
-            return true;
-        } else if (c == 'x') {
-            down = true;
+        } else if (c == 'g') {
+            setMeshingMode(meshingMode_ == Chunk::MeshingMode::Greedy
+                ? Chunk::MeshingMode::PerFace
+                : Chunk::MeshingMode::Greedy);
             return true;
         } else return false;
     }
 
     bool onKeyRelease(char c) {
-        if (c == 'w') {
-            forwards = false;
-            return true;
-        } else if (c == 'a') {
-            left = false;
-            return true;
-        } else if (c == 's') {
-            backwards = false;
-            return true;
-        } else if (c == 'd') {
-            right = false;
-            return true;
-        } else if (c == 'z') {
-            up = false;
-            return true;
-        } else if (c == 'x') {
-            down = false;
+        if (const uint8_t key = movementKey(c)) {
+            simulation_.setInput((Simulation::Input) key, false);
             return true;
         } else return false;
     }
@@ -496,41 +1966,209 @@ public:
 
     }
 
+    /**
+     * Moves the camera drawn this frame to the simulated camera, interpolated
+     * between its last two ticks for the current time.
+     */
     void update() {
-        typedef std::chrono::duration<float> seconds;
-        static auto start = std::chrono::steady_clock::now();
-        auto end = std::chrono::steady_clock::now(); 
-        auto elapsed = std::chrono::duration_cast<seconds>(end - start);
-        start = end;
-        float dt = elapsed.count();
+        ScopedTrace trace("GameEngine::update");
+        const CameraState state = simulation_.interpolate(Simulation::Clock::now());
+        playerCamera().setPosition(state.x, state.y, state.z);
+        playerCamera().setTheta(state.theta);
+    }
+
+    /**
+     * Flood fills the visibility graph from the section holding the camera,
+     * stepping from a section to its neighbour through a face only if it
+     * sees the face the section was entered through, and recording every
+     * section reached inside the view frustum. A path never steps against a
+     * direction it has already taken, as no line of sight bends back on
+     * itself, which keeps the fill from creeping around terrain.
+     */
+    void findReachableSections(const Frustum &frustum, int d) {
+        static const int steps[SectionVisibility::FACE_COUNT][3] = {
+            {0, -1, 0}, {0, 1, 0}, {-1, 0, 0}, {1, 0, 0}, {0, 0, 1}, {0, 0, -1},
+        };
+        const Chunk::Location center = world_.cameraLocation();
+        const int n = 2 * d + 1;
+        reachable_.assign(n * n, 0);
+        visibilitySteps_.clear();
+
+        const int section = world_.cameraSection();
+        reachable_[d * n + d] |= 1 << section;
+        visibilitySteps_.push_back({0, 0, section, -1, 0});
+
+        for (size_t i = 0; i < visibilitySteps_.size(); i++) {
+            const VisibilityStep step = visibilitySteps_[i];
+            Chunk *chunk = world_.getNeighbour(center, step.x, step.y);
+            const uint16_t visibility = chunk != nullptr && chunk->isGenerated() ? chunk->sectionVisibility(step.section) : SectionVisibility::ALL;
+
+            for (int face = 0; face < SectionVisibility::FACE_COUNT; face++) {
+                if (step.directions & (1 << SectionVisibility::opposite(face))) continue;
+                if (step.from >= 0 && !SectionVisibility::connects(visibility, step.from, face)) continue;
+                const int x = step.x + steps[face][0];
+                const int y = step.y + steps[face][1];
+                const int s = step.section + steps[face][2];
+                if (s < 0 || s >= Chunk::SECTION_COUNT || std::abs(x) > d || std::abs(y) > d) continue;
+
+                uint16_t &reached = reachable_[(y + d) * n + x + d];
+                if (reached & (1 << s)) continue;
+                if (world_.getNeighbour(center, x, y) == nullptr) continue;
+                const int z0 = s * Chunk::SECTION_HEIGHT;
+                if (!isVisible(frustum, {center.first + x, center.second + y}, z0, z0 + Chunk::SECTION_HEIGHT)) continue;
+                reached |= 1 << s;
+                visibilitySteps_.push_back({x, y, s, SectionVisibility::opposite(face), (uint8_t) (step.directions | 1 << face)});
+            }
+        }
+    }
+
+    /**
+     * Returns the set of sections of the chunk at the given location reached
+     * by the last flood fill, or every section with occlusion culling off.
+     */
+    uint16_t reachableSections(Chunk::Location location, int d) {
+        if (!occlusionCulling_) return Chunk::ALL_SECTIONS;
+        const Chunk::Location center = world_.cameraLocation();
+        const int x = location.first - center.first;
+        const int y = location.second - center.second;
+        if (std::abs(x) > d || std::abs(y) > d) return 0;
+        return reachable_[(y + d) * (2 * d + 1) + x + d];
+    }
 
-        if (forwards) playerCamera().moveForwards(dt);
-        if (left) playerCamera().moveLeft(dt);
-        if (backwards) playerCamera().moveBackwards(dt);
-        if (right) playerCamera().moveRight(dt);
-        if (up) playerCamera().moveUp(dt);
-        if (down) playerCamera().moveDown(dt);
+    /**
+     * Adds the section meshes of the given chunk that lie inside the view
+     * frustum and among the given reachable sections to the draw list.
+     */
+    void drawSections(const Frustum &frustum, Chunk &chunk, uint16_t reachable) {
+        const Chunk::Location location = chunk.getLocation();
+        for (int section = 0; section < Chunk::SECTION_COUNT; section++) {
+            NativeBuffer* buffer = chunk.getBuffer(section);
+            if (buffer == nullptr) continue;
+            const int z0 = section * Chunk::SECTION_HEIGHT;
+            const int z1 = z0 + Chunk::SECTION_HEIGHT;
+            if (!isVisible(frustum, location, z0, z1)) {
+                culledSectionCount_++;
+                continue;
+            }
+            if (!(reachable & (1 << section))) {
+                occludedCount_++;
+                continue;
+            }
+            drawList_.add(*buffer, playerCamera(), {0, 0, (float) z0}, {Chunk::WIDTH, Chunk::WIDTH, (float) z1});
+            vertexCount_ += buffer->size();
+            drawnCount_++;
+        }
     }
+
     void render() {
-        std::vector<NativeBuffer> buffers;
+        ScopedTrace trace("GameEngine::render");
+        const auto start = std::chrono::steady_clock::now();
+        drawList_.clear();
+        vertexCount_ = 0;
+        culledCount_ = 0;
+        culledSectionCount_ = 0;
+        drawnCount_ = 0;
+        occludedCount_ = 0;
+        std::fill_n(lodCounts_, Chunk::LOD_LEVELS, 0);
 
         update();
 
-        int d = 10;
+        const int d = renderDistance_;
+        const Frustum frustum(playerCamera().viewProjection());
 
-        for(Chunk *chunk: world_.getChunksWithinRenderDistance(d)) {
-            if (chunk->isModified()) {
-                chunk->computeBuffer(device_);
-            } else {
-                NativeBuffer* buffer = chunk->getBuffer();
-                if (buffer != nullptr) {
-                    buffers.push_back(*buffer);
+        {
+            ScopedTrace trace("World::applyEdits");
+            world_.applyEdits();
+        }
+
+        const std::vector<Chunk*> &chunks = world_.getChunksWithinRenderDistance(d);
+        if (occlusionCulling_) {
+            ScopedTrace trace("GameEngine::findReachableSections");
+            findReachableSections(frustum, d);
+        }
+
+        {
+            ScopedTrace trace("GameEngine::scheduleMeshing");
+            for (Chunk *chunk: chunks) {
+                if (!chunk->isGenerated()) continue;
+
+                const Chunk::Location location = chunk->getLocation();
+                const float dx = (location.first + 0.5f) - playerCamera().x() / Chunk::WIDTH;
+                const float dy = (location.second + 0.5f) - playerCamera().y() / Chunk::WIDTH;
+                const int level = chunk->selectLod(std::sqrt(dx * dx + dy * dy), lodDistances_, LOD_HYSTERESIS);
+                if (level == 0 && chunk->isModified()) {
+                    chunk->computeBuffer(device_, world_.threadPool(), world_.priority(location), meshingMode_, world_.meshCache());
+                } else if (level > 0) {
+                    chunk->computeLod(device_, world_.threadPool(), world_.priority(location));
                 }
             }
+        }
 
+        {
+            ScopedTrace trace("GameEngine::collectBuffers");
+            for (Chunk *chunk: chunks) {
+                if (!chunk->isGenerated()) continue;
+
+                const Chunk::Location location = chunk->getLocation();
+                const int level = chunk->lod();
+                const std::pair<int, int> height = chunk->heightBounds();
+                if (!isVisible(frustum, location, height.first, height.second)) {
+                    culledCount_++;
+                    continue;
+                }
+
+                // A chunk switching level keeps drawing its old meshes until the
+                // new ones are built, and only then frees the old ones.
+                const uint16_t reachable = reachableSections(location, d);
+                NativeBuffer *lod = nullptr;
+                if (level == 0) {
+                    drawSections(frustum, *chunk, reachable);
+                    if (chunk->hasSections()) {
+                        chunk->releaseLod();
+                    } else {
+                        lod = chunk->getLodBuffer();
+                    }
+                } else {
+                    lod = chunk->getLodBuffer();
+                    if (chunk->lodBufferLevel() == level) chunk->releaseSections();
+                    if (lod == nullptr && chunk->lodBufferLevel() == 0) drawSections(frustum, *chunk, reachable);
+                }
+
+                if (lod != nullptr && reachable == 0) {
+                    occludedCount_++;
+                } else if (lod != nullptr) {
+                    const float bottom = std::max(0, height.first - Chunk::LOD_SKIRT_DEPTH);
+                    drawList_.add(*lod, playerCamera(), {0, 0, bottom}, {Chunk::WIDTH, Chunk::WIDTH, (float) height.second});
+                    vertexCount_ += lod->size();
+                    drawnCount_++;
+                    lodCounts_[chunk->lodBufferLevel()]++;
+                } else if (chunk->hasSections()) {
+                    lodCounts_[0]++;
+                }
+            }
         }
 
-        draw_(buffers);
+        {
+            ScopedTrace trace("GameEngine::submit");
+            drawList_.sort();
+            if (backend_ != nullptr) drawList_.submit(*backend_, playerCamera());
+        }
+
+        {
+            ScopedTrace trace("World::evictChunks");
+            world_.evictChunks(d);
+        }
+
+        if (start - metricsTime_ >= std::chrono::milliseconds(METRICS_INTERVAL_MS)) {
+            world_.updateMetrics();
+            metricsTime_ = start;
+        }
+        frameVertices_.set(vertexCount_);
+        frameDraws_.set(drawnCount_);
+        frameCulled_.set(culledCount_);
+        frameOccluded_.set(occludedCount_);
+        frameTime_.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        frames_.add();
     };
 
 };
@@ -0,0 +1,115 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "Buffer.h"
+#include "Region.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * The MeshKey struct identifies the mesh of one section of a chunk by what it
+ * was built from: a hash of the blocks the mesher read and the version of the
+ * mesher that built it.
+ */
+struct MeshKey {
+    std::pair<int, int> location;
+    int section;
+    uint64_t hash;
+    uint32_t version;
+};
+
+/**
+ * The MeshCache class keeps finished section meshes in region files, one slot
+ * for every section of every chunk, so that a revisited area is drawn from
+ * disk instead of being meshed again. Each slot holds the key of its mesh
+ * followed by the vertices, and a lookup only hits if the whole key matches,
+ * so meshes of changed blocks or of an older mesher are never drawn. A slot
+ * is simply overwritten when its section is meshed again.
+ *
+ * A MeshCache may be used from several threads at once.
+ */
+class MeshCache {
+private:
+    struct Record {
+        uint64_t hash;
+        uint32_t version;
+        uint32_t count;
+    };
+
+    RegionStore store_;
+    std::mutex mutex_;
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+
+public:
+
+    /**
+     * Keeps meshes in the given directory for chunks of the given number of
+     * sections.
+     */
+    MeshCache(std::string directory, int sections): store_(std::move(directory), ".meshes", sections) {}
+
+    /**
+     * Looks up the mesh with the given key and, on a hit, passes its vertices
+     * and their count to use, which must copy them before returning since
+     * they point into a memory mapped file. Returns false on a miss.
+     */
+    template<typename Use>
+    bool find(const MeshKey &key, Use use) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t length = 0;
+        const uint8_t *data = store_.read(key.location, length, key.section);
+        Record record;
+        if (data == nullptr || length < sizeof(Record)) {
+            misses_++;
+            return false;
+        }
+        std::memcpy(&record, data, sizeof(Record));
+        if (record.hash != key.hash || record.version != key.version || length != sizeof(Record) + record.count * sizeof(Vertex)) {
+            misses_++;
+            return false;
+        }
+        use((const Vertex*) (data + sizeof(Record)), (size_t) record.count);
+        hits_++;
+        return true;
+    }
+
+    /**
+     * Stores the given mesh under the given key, replacing the mesh kept for
+     * the same section.
+     */
+    bool store(const MeshKey &key, const Buffer &mesh) {
+        const Record record = {key.hash, key.version, (uint32_t) mesh.size()};
+        std::vector<uint8_t> bytes(sizeof(Record) + mesh.size() * sizeof(Vertex));
+        std::memcpy(bytes.data(), &record, sizeof(Record));
+        if (mesh.size() > 0) std::memcpy(bytes.data() + sizeof(Record), mesh.data(), mesh.size() * sizeof(Vertex));
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        return store_.write(key.location, bytes, key.section);
+    }
+
+    size_t hits() const {
+        return hits_;
+    }
+
+    size_t misses() const {
+        return misses_;
+    }
+
+    /**
+     * Returns the fraction of lookups that hit, or zero before the first one.
+     */
+    float hitRate() const {
+        const size_t hits = hits_;
+        const size_t lookups = hits + misses_;
+        return lookups == 0 ? 0.0f : (float) hits / lookups;
+    }
+};
+
+#endif /* MESH_CACHE_H */
@@ -0,0 +1,235 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * The Counter class counts events, such as chunks generated.
+ */
+class Counter {
+private:
+    std::atomic<uint64_t> value_{0};
+
+public:
+    void add(uint64_t n = 1) {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * The Gauge class holds a level that rises and falls, such as the number of
+ * chunks being meshed.
+ */
+class Gauge {
+private:
+    std::atomic<int64_t> value_{0};
+
+public:
+    void set(int64_t value) {
+        value_.store(value, std::memory_order_relaxed);
+    }
+
+    void add(int64_t n) {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    int64_t value() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * The Histogram class counts durations in microseconds in buckets whose
+ * bounds double, so percentiles are known to within a factor of two while
+ * recording stays a few atomic additions.
+ */
+class Histogram {
+public:
+    static constexpr int BUCKET_COUNT = 40;
+
+    struct Summary {
+        uint64_t count;
+        double mean;
+        double p50;
+        double p95;
+        double p99;
+        double max;
+    };
+
+private:
+    std::atomic<uint64_t> buckets_[BUCKET_COUNT] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+
+    /**
+     * Bucket 0 holds durations under 1 us and bucket i those from 2^(i-1)
+     * up to 2^i us.
+     */
+    static int bucket(uint64_t us) {
+        int i = 0;
+        while (us > 0 && i < BUCKET_COUNT - 1) {
+            us >>= 1;
+            i++;
+        }
+        return i;
+    }
+
+public:
+    void record(uint64_t us) {
+        buckets_[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(us, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (us > max && !max_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+    }
+
+    /**
+     * Returns the count, mean and maximum, and the upper bound of the bucket
+     * holding each percentile, capped at the maximum. Values recorded while
+     * summarizing may be seen only in part.
+     */
+    Summary summary() const {
+        uint64_t counts[BUCKET_COUNT];
+        uint64_t total = 0;
+        for (int i = 0; i < BUCKET_COUNT; i++) {
+            counts[i] = buckets_[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        const double max = (double) max_.load(std::memory_order_relaxed);
+        auto percentile = [&](double p) {
+            if (total == 0) return 0.0;
+            const uint64_t rank = std::max<uint64_t>(1, (uint64_t) (p * total + 0.999999));
+            uint64_t seen = 0;
+            for (int i = 0; i < BUCKET_COUNT; i++) {
+                seen += counts[i];
+                if (seen >= rank) return std::min(max, (double) (i == 0 ? 1 : uint64_t(1) << i));
+            }
+            return max;
+        };
+        const uint64_t sum = sum_.load(std::memory_order_relaxed);
+        return {total, total == 0 ? 0.0 : (double) sum / total, percentile(0.50), percentile(0.95), percentile(0.99), max};
+    }
+};
+
+/**
+ * The MetricsSnapshot struct holds the values of every metric of a registry
+ * at one point in time, sorted by name.
+ */
+struct MetricsSnapshot {
+    std::vector<std::pair<std::string, uint64_t>> counters;
+    std::vector<std::pair<std::string, int64_t>> gauges;
+    std::vector<std::pair<std::string, Histogram::Summary>> histograms;
+
+    /**
+     * Returns the value of the counter with the given name, or zero if there
+     * is none.
+     */
+    uint64_t counter(const std::string &name) const {
+        for (const auto &it: counters) {
+            if (it.first == name) return it.second;
+        }
+        return 0;
+    }
+
+    int64_t gauge(const std::string &name) const {
+        for (const auto &it: gauges) {
+            if (it.first == name) return it.second;
+        }
+        return 0;
+    }
+
+    Histogram::Summary histogram(const std::string &name) const {
+        for (const auto &it: histograms) {
+            if (it.first == name) return it.second;
+        }
+        return {0, 0, 0, 0, 0, 0};
+    }
+
+    /**
+     * Writes the snapshot as one JSON object with a member for each kind of
+     * metric.
+     */
+    void writeJson(std::ostream &out) const {
+        out << "{\"counters\":{";
+        for (size_t i = 0; i < counters.size(); i++) {
+            out << (i ? "," : "") << "\"" << counters[i].first << "\":" << counters[i].second;
+        }
+        out << "},\"gauges\":{";
+        for (size_t i = 0; i < gauges.size(); i++) {
+            out << (i ? "," : "") << "\"" << gauges[i].first << "\":" << gauges[i].second;
+        }
+        out << "},\"histograms\":{";
+        for (size_t i = 0; i < histograms.size(); i++) {
+            const Histogram::Summary &s = histograms[i].second;
+            out << (i ? "," : "") << "\"" << histograms[i].first << "\":{\"count\":" << s.count
+                << ",\"mean\":" << s.mean << ",\"p50\":" << s.p50 << ",\"p95\":" << s.p95
+                << ",\"p99\":" << s.p99 << ",\"max\":" << s.max << "}";
+        }
+        out << "}}";
+    }
+};
+
+/**
+ * The MetricsRegistry class owns named counters, gauges and histograms.
+ * Metrics are created on first lookup and never removed, so callers look
+ * them up once and keep the reference. Updating a metric and taking a
+ * snapshot may happen on any thread.
+ */
+class MetricsRegistry {
+private:
+    mutable std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<Counter>> counters_;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges_;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms_;
+
+    template<typename T>
+    T& get(std::map<std::string, std::unique_ptr<T>> &metrics, const std::string &name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::unique_ptr<T> &metric = metrics[name];
+        if (metric == nullptr) metric.reset(new T);
+        return *metric;
+    }
+
+public:
+    Counter& counter(const std::string &name) {
+        return get(counters_, name);
+    }
+
+    Gauge& gauge(const std::string &name) {
+        return get(gauges_, name);
+    }
+
+    Histogram& histogram(const std::string &name) {
+        return get(histograms_, name);
+    }
+
+    MetricsSnapshot snapshot() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        MetricsSnapshot snapshot;
+        for (const auto &it: counters_) {
+            snapshot.counters.push_back({it.first, it.second->value()});
+        }
+        for (const auto &it: gauges_) {
+            snapshot.gauges.push_back({it.first, it.second->value()});
+        }
+        for (const auto &it: histograms_) {
+            snapshot.histograms.push_back({it.first, it.second->summary()});
+        }
+        return snapshot;
+    }
+};
+
+#endif /* METRICS_H */
@@ -8,6 +8,10 @@ private:
     float z_ = 0.0f;
     float theta_ = 0.0f;
     float v_ = 100.0;
+    float fov_ = (2 * M_PI) / 5;
+    float aspect_ = 1.0f;
+    float near_ = 0.01f;
+    float far_ = 1000.0f;
 public:
     PlayerCamera(float x, float y, float z, float theta) {
         x_ = x;
@@ -21,6 +25,36 @@ public:
     float z() const { return z_; }
     float theta() const { return theta_; }
 
+    float fov() const { return fov_; }
+    float aspect() const { return aspect_; }
+    float near() const { return near_; }
+    float far() const { return far_; }
+
+    void setAspect(float aspect) {
+        aspect_ = aspect;
+    }
+
+    void setPosition(float x, float y, float z) {
+        x_ = x;
+        y_ = y;
+        z_ = z;
+    }
+
+    void setTheta(float theta) {
+        theta_ = theta;
+    }
+
+    /**
+     * Returns the projection and rotation of this camera. The translation is
+     * left out, so the matrix transforms positions relative to the camera,
+     * with the y and z axes swapped as in the vertex shader.
+     */
+    matrix_float4x4 viewProjection() const {
+        matrix_float4x4 perspective = matrix_projection(fov_, aspect_, near_, far_);
+        matrix_float4x4 rotation = matrix_from_rotation(-theta_ * M_PI / 180, 0, 1, 0);
+        return simd_mul(perspective, rotation);
+    }
+
     void rotateTheta(float dtheta) {
         theta_ += dtheta;
     }
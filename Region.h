@@ -0,0 +1,367 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include "ChunkMap.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * The RegionFile class stores a fixed number of slots of data in one file,
+ * such as the serialized blocks of a square of chunks. The file starts with
+ * a table holding the offset and length of every slot, followed by the
+ * data. Reads come straight from a memory mapping of the file. Writes append
+ * the new data and then point the table at it, so a slot is never left half
+ * written, and the file is compacted once more than half of it is data that
+ * is no longer referenced.
+ *
+ * A RegionFile is not thread safe.
+ */
+class RegionFile {
+public:
+    static constexpr int WIDTH = 32;
+    static constexpr int CHUNK_COUNT = WIDTH * WIDTH;
+
+private:
+    static constexpr uint32_t MAGIC = 0x47525254;
+    static constexpr uint32_t VERSION = 2;
+
+    /**
+     * Files smaller than this are not compacted however much of them is
+     * garbage.
+     */
+    static constexpr uint64_t MIN_COMPACT_SIZE = 1 << 20;
+
+    struct Entry {
+        uint64_t offset;
+        uint32_t length;
+        uint32_t reserved;
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t count;
+        uint32_t reserved;
+    };
+
+    std::string path_;
+    int fd_ = -1;
+    std::vector<Entry> entries_;
+    uint64_t size_ = 0;
+    uint64_t live_ = 0;
+    const uint8_t *map_ = nullptr;
+    size_t mapped_ = 0;
+
+    static bool writeAll(int fd, const void *data, size_t length, uint64_t offset) {
+        const uint8_t *bytes = (const uint8_t*) data;
+        while (length > 0) {
+            const ssize_t n = pwrite(fd, bytes, length, (off_t) offset);
+            if (n <= 0) return false;
+            bytes += n;
+            length -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    uint64_t tableSize() const {
+        return sizeof(Header) + entries_.size() * sizeof(Entry);
+    }
+
+    /**
+     * Writes the header and the given table at the start of the given file.
+     */
+    bool writeTable(int fd, const std::vector<Entry> &entries) const {
+        const Header header = {MAGIC, VERSION, (uint32_t) entries.size(), 0};
+        return writeAll(fd, &header, sizeof(Header), 0)
+            && writeAll(fd, entries.data(), entries.size() * sizeof(Entry), sizeof(Header));
+    }
+
+    void unmap() {
+        if (map_ != nullptr) munmap((void*) map_, mapped_);
+        map_ = nullptr;
+        mapped_ = 0;
+    }
+
+    /**
+     * Maps the whole file, remapping it if it has grown since it was last
+     * mapped.
+     */
+    bool map() {
+        if (map_ != nullptr && mapped_ == size_) return true;
+        unmap();
+        void *p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) return false;
+        map_ = (const uint8_t*) p;
+        mapped_ = size_;
+        return true;
+    }
+
+    void close() {
+        unmap();
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+    }
+
+    /**
+     * Opens the file, creating it with an empty table if it does not exist.
+     * A file with an unknown format, another number of slots or a table
+     * pointing past its end is moved aside to the same path with ".bak"
+     * appended and replaced by an empty one, so the region stays writable.
+     * If that fails the region is left closed and every write to it fails.
+     */
+    void open() {
+        fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0) return;
+
+        struct stat st;
+        if (fstat(fd_, &st) != 0) return close();
+        size_ = st.st_size;
+
+        if (size_ == 0) {
+            if (!writeTable(fd_, entries_)) return close();
+            size_ = tableSize();
+            return;
+        }
+        if (!readTable()) replace();
+    }
+
+    /**
+     * Reads the header and table of the open file, returning false if they
+     * do not describe a region of this format and number of slots.
+     */
+    bool readTable() {
+        Header header;
+        if (size_ < tableSize() || pread(fd_, &header, sizeof(Header), 0) != (ssize_t) sizeof(Header)) return false;
+        if (header.magic != MAGIC || header.version != VERSION || header.count != entries_.size()) return false;
+        const size_t bytes = entries_.size() * sizeof(Entry);
+        if (pread(fd_, entries_.data(), bytes, sizeof(Header)) != (ssize_t) bytes) return false;
+        for (const Entry &entry: entries_) {
+            if (entry.length == 0) continue;
+            if (entry.offset < tableSize() || entry.offset + entry.length > size_) return false;
+            live_ += entry.length;
+        }
+        return true;
+    }
+
+    /**
+     * Moves the open file aside and starts an empty one in its place.
+     */
+    void replace() {
+        close();
+        std::fill(entries_.begin(), entries_.end(), Entry{0, 0, 0});
+        live_ = 0;
+        size_ = 0;
+        const std::string backup = path_ + ".bak";
+        if (rename(path_.c_str(), backup.c_str()) != 0) return;
+        fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) return;
+        if (!writeTable(fd_, entries_)) return close();
+        size_ = tableSize();
+    }
+
+public:
+
+    /**
+     * Opens the region file at the given path holding the given number of
+     * slots, by default one for every chunk of the region.
+     */
+    explicit RegionFile(std::string path, size_t slots = CHUNK_COUNT): path_(std::move(path)), entries_(slots, Entry{0, 0, 0}) {
+        open();
+    }
+
+    ~RegionFile() {
+        close();
+    }
+
+    RegionFile(const RegionFile&) = delete;
+    RegionFile& operator=(const RegionFile&) = delete;
+
+    bool isOpen() const {
+        return fd_ >= 0;
+    }
+
+    size_t slots() const {
+        return entries_.size();
+    }
+
+    /**
+     * Returns the data in the slot at the given index and sets length to its
+     * size, or returns nullptr if the slot is empty. The data points into the
+     * mapping and is valid until the next write.
+     */
+    const uint8_t* read(int index, size_t &length) {
+        if (fd_ < 0) return nullptr;
+        const Entry &entry = entries_[index];
+        if (entry.length == 0 || !map()) return nullptr;
+        length = entry.length;
+        return map_ + entry.offset;
+    }
+
+    /**
+     * Stores the given data in the slot at the given index, replacing what
+     * was stored before. Returns false if the file could not be written.
+     */
+    bool write(int index, const uint8_t *data, size_t length) {
+        if (fd_ < 0 || length == 0 || length > UINT32_MAX) return false;
+        if (!writeAll(fd_, data, length, size_)) return false;
+
+        Entry &entry = entries_[index];
+        const Entry previous = entry;
+        entry = {size_, (uint32_t) length, 0};
+        if (!writeAll(fd_, &entry, sizeof(Entry), sizeof(Header) + index * sizeof(Entry))) {
+            entry = previous;
+            return false;
+        }
+        live_ += length - previous.length;
+        size_ += length;
+
+        if (size_ >= MIN_COMPACT_SIZE && garbage() > live_) compact();
+        return true;
+    }
+
+    /**
+     * Rewrites the file with only the data its table references, replacing
+     * the old file once the new one is complete.
+     */
+    bool compact() {
+        if (fd_ < 0 || !map()) return false;
+        const std::string path = path_ + ".tmp";
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+
+        std::vector<Entry> entries = entries_;
+        uint64_t offset = tableSize();
+        for (Entry &entry: entries) {
+            if (entry.length == 0) continue;
+            if (!writeAll(fd, map_ + entry.offset, entry.length, offset)) {
+                ::close(fd);
+                unlink(path.c_str());
+                return false;
+            }
+            entry.offset = offset;
+            offset += entry.length;
+        }
+        if (!writeTable(fd, entries) || fsync(fd) != 0 || rename(path.c_str(), path_.c_str()) != 0) {
+            ::close(fd);
+            unlink(path.c_str());
+            return false;
+        }
+
+        close();
+        fd_ = fd;
+        entries_ = std::move(entries);
+        size_ = offset;
+        return true;
+    }
+
+    /**
+     * Returns the number of bytes of chunk data no longer referenced by the
+     * table.
+     */
+    uint64_t garbage() const {
+        return size_ - tableSize() - live_;
+    }
+
+    uint64_t size() const {
+        return size_;
+    }
+};
+
+/**
+ * The RegionStore class keeps the region files of a directory open and maps
+ * chunk locations to the file and table index that store them. Each chunk
+ * may have several slots, stored next to each other in the table.
+ */
+class RegionStore {
+public:
+    using Location = std::pair<int, int>;
+
+private:
+
+    /**
+     * Every open region is closed once this many are open, so a long flight
+     * across the world does not run out of file descriptors.
+     */
+    static constexpr size_t MAX_OPEN_REGIONS = 64;
+
+    std::string directory_;
+    std::string extension_;
+    int slots_;
+    ChunkMap<RegionFile> regions_;
+
+    static int floorDiv(int a, int b) {
+        return a / b - (a % b != 0 && (a < 0) != (b < 0));
+    }
+
+    RegionFile* region(Location loc, int slot, int &index) {
+        const Location region(floorDiv(loc.first, RegionFile::WIDTH), floorDiv(loc.second, RegionFile::WIDTH));
+        const int chunk = (loc.second - region.second * RegionFile::WIDTH) * RegionFile::WIDTH + loc.first - region.first * RegionFile::WIDTH;
+        index = chunk * slots_ + slot;
+        if (RegionFile *file = regions_.get(region)) return file;
+
+        if (regions_.size() >= MAX_OPEN_REGIONS) regions_ = ChunkMap<RegionFile>();
+        const std::string path = directory_ + "/r." + std::to_string(region.first) + "." + std::to_string(region.second) + extension_;
+        return regions_.insert(region, std::unique_ptr<RegionFile>(new RegionFile(path, RegionFile::CHUNK_COUNT * slots_)));
+    }
+
+public:
+
+    /**
+     * Stores regions in the given directory, which is created along with any
+     * missing parents if it does not exist, in files with the given extension
+     * holding the given number of slots for every chunk.
+     */
+    explicit RegionStore(std::string directory, std::string extension = ".region", int slots = 1):
+        directory_(std::move(directory)), extension_(std::move(extension)), slots_(slots) {
+        for (size_t i = directory_.find('/', 1); ; i = directory_.find('/', i + 1)) {
+            mkdir(directory_.substr(0, i).c_str(), 0755);
+            if (i == std::string::npos) break;
+        }
+    }
+
+    /**
+     * Returns true if the directory exists, so regions can be stored in it.
+     */
+    bool isAvailable() const {
+        struct stat st;
+        return stat(directory_.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    /**
+     * Returns the data stored in the given slot of the chunk at the given
+     * location and sets length to its size, or returns nullptr if nothing is
+     * stored there. The data is valid until the next write.
+     */
+    const uint8_t* read(Location loc, size_t &length, int slot = 0) {
+        int index;
+        return region(loc, slot, index)->read(index, length);
+    }
+
+    bool write(Location loc, const uint8_t *data, size_t length, int slot = 0) {
+        int index;
+        return region(loc, slot, index)->write(index, data, length);
+    }
+
+    bool write(Location loc, const std::vector<uint8_t> &data, int slot = 0) {
+        return write(loc, data.data(), data.size(), slot);
+    }
+
+    const std::string& directory() const {
+        return directory_;
+    }
+};
+
+#endif /* REGION_H */
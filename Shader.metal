@@ -8,11 +8,21 @@ using namespace metal;
 typedef struct {
     float4 position [[position]];
     float2 textureCoordinate;
+    float2 tile [[flat]];
     float3 normal;
     float secondsSinceFirstLoaded;
     float distance;
 } RasterizerData;
 
+constant float3 normals[] = {
+    float3(0.0, 0.0, -1.0),
+    float3(0.0, 0.0, 1.0),
+    float3(-1.0, 0.0, 0.0),
+    float3(1.0, 0.0, 0.0),
+    float3(0.0, 1.0, 0.0),
+    float3(0.0, -1.0, 0.0),
+};
+
 vertex RasterizerData vertexShader (
         uint vertexID [[vertex_id]],
         constant Vertex *vertices [[buffer(0)]],
@@ -21,15 +31,24 @@ vertex RasterizerData vertexShader (
         constant float4x4 &camera [[buffer(3)]],
         constant float &secondsSinceFirstLoaded [[buffer(4)]]
 ) {
-    
+    const Vertex v = vertices[vertexID];
+    const float3 p = float3(
+        (v >> VERTEX_X_SHIFT) & 0x1f,
+        (v >> VERTEX_Y_SHIFT) & 0x1f,
+        (v >> VERTEX_Z_SHIFT) & 0x1ff
+    );
+    const uint face = (v >> VERTEX_FACE_SHIFT) & 0x7;
+    const uint tile = (v >> VERTEX_TILE_SHIFT) & 0xff;
+
     RasterizerData out;
-    out.position = vector_float4(0.0, 0.0, 0.0, 1.0);
-    out.position.x = vertices[vertexID].position.x;
-    out.position.y = vertices[vertexID].position.z;
-    out.position.z = vertices[vertexID].position.y;
-    out.position = camera * mvp * out.position;
-    out.textureCoordinate = vertices[vertexID].textureCoordinate;
-    out.normal = vertices[vertexID].normal;
+    out.position = camera * mvp * vector_float4(p.x, p.z, p.y, 1.0);
+    // Faces repeat their texture once per block, so the texture coordinate is
+    // the position along the two axes spanning the face.
+    if (face < 2) out.textureCoordinate = -p.xz;
+    else if (face < 4) out.textureCoordinate = -p.yz;
+    else out.textureCoordinate = -p.yx;
+    out.tile = float2(tile % 16, tile / 16);
+    out.normal = normals[face];
     out.secondsSinceFirstLoaded = secondsSinceFirstLoaded;
     out.distance =  1.0 + 0.001 * exp(dot(out.position.xz, out.position.xz) / 1000);
     return out;
@@ -39,7 +58,12 @@ fragment float4 fragmentShader (RasterizerData in [[stage_in]], texture2d<float>
     const float3 directionalLight = normalize(vector_float3(0.5, 0.8, 1.0));
     const float brightness = 4.0 / 7.0 + 3 * dot(directionalLight, in.normal) / 7.0;
     constexpr sampler textureSampler(filter::nearest, address::clamp_to_zero, mip_filter::linear, lod_clamp(0.0f, MAXFLOAT), max_anisotropy(16));
-    float4 out = brightness * colorTexture.sample(textureSampler, in.textureCoordinate);
+    // Wrap the block-space coordinate into its atlas tile so merged faces repeat
+    // the texture. The gradient is taken before wrapping to keep mip selection
+    // continuous across block edges.
+    const float2 uv = (in.tile + fract(in.textureCoordinate)) / 16.0;
+    const gradient2d gradient(dfdx(in.textureCoordinate) / 16.0, dfdy(in.textureCoordinate) / 16.0);
+    float4 out = brightness * colorTexture.sample(textureSampler, uv, gradient);
     out.a = in.secondsSinceFirstLoaded > 0.5 ? 1.0: 2.0 * in.secondsSinceFirstLoaded;
     out = (1.0 / in.distance) * out + (1.0 - 1.0 / in.distance) * vector_float4(0.707, 0.8125, 0.957, 1);
     out.a = 1.0;
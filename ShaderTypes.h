@@ -1,12 +1,42 @@
 #ifndef SHADER_TYPES_H
 #define SHADER_TYPES_H
 
+#ifdef __METAL_VERSION__
 #include <simd/simd.h>
+#else
+#include "Simd.h"
+#include <stdint.h>
+#endif
 
-typedef struct {
-    simd::float3 position;
-    simd::float2 textureCoordinate;
-    simd::float3 normal;
-} Vertex;
+/**
+ * A vertex is packed into 32 bits. The position is a block corner relative to
+ * the chunk, whose origin is applied by the per-draw mvp matrix. The face is
+ * the index of the side bit in Block, from which the shader derives the normal
+ * and the texture coordinate, and the tile is the atlas tile at column
+ * tile % 16 and row tile / 16.
+ *
+ *   bits  0-4   x       0 to 16
+ *   bits  5-9   y       0 to 16
+ *   bits 10-18  z       0 to 256
+ *   bits 19-21  face    0 to 5
+ *   bits 22-29  tile    0 to 255
+ */
+typedef uint32_t Vertex;
+
+#define VERTEX_X_SHIFT 0
+#define VERTEX_Y_SHIFT 5
+#define VERTEX_Z_SHIFT 10
+#define VERTEX_FACE_SHIFT 19
+#define VERTEX_TILE_SHIFT 22
+
+#ifndef __METAL_VERSION__
+inline Vertex makeVertex(uint32_t x, uint32_t y, uint32_t z, uint32_t face, uint32_t tile) {
+    return x << VERTEX_X_SHIFT
+        | y << VERTEX_Y_SHIFT
+        | z << VERTEX_Z_SHIFT
+        | face << VERTEX_FACE_SHIFT
+        | tile << VERTEX_TILE_SHIFT;
+}
+#endif
 
 #endif /* SHADER_TYPES_H */
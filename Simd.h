@@ -0,0 +1,100 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#ifdef __APPLE__
+#include <simd/simd.h>
+#else
+
+#include <cmath>
+
+/**
+ * Portable stand-ins for the few parts of Apple's simd library used outside
+ * the renderer, so the engine builds on hosts without it. The vectors are
+ * plain structs rather than compiler vector types and only the operations
+ * the engine uses are provided.
+ */
+namespace simd {
+
+struct float3 {
+    float x, y, z;
+
+    float& operator[](int i) {
+        return (&x)[i];
+    }
+
+    float operator[](int i) const {
+        return (&x)[i];
+    }
+};
+
+struct float4 {
+    float x, y, z, w;
+
+    float& operator[](int i) {
+        return (&x)[i];
+    }
+
+    float operator[](int i) const {
+        return (&x)[i];
+    }
+};
+
+struct int3 {
+    int x, y, z;
+
+    int& operator[](int i) {
+        return (&x)[i];
+    }
+
+    int operator[](int i) const {
+        return (&x)[i];
+    }
+};
+
+inline float4 operator+(float4 a, float4 b) {
+    return {a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w};
+}
+
+inline float4 operator-(float4 a, float4 b) {
+    return {a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w};
+}
+
+inline float4 operator*(float s, float4 v) {
+    return {s * v.x, s * v.y, s * v.z, s * v.w};
+}
+
+} // namespace simd
+
+typedef simd::float3 vector_float3;
+typedef simd::float4 vector_float4;
+
+/**
+ * A column major 4x4 matrix, as in simd.
+ */
+struct matrix_float4x4 {
+    vector_float4 columns[4];
+};
+
+static const matrix_float4x4 matrix_identity_float4x4 = {{
+    {1, 0, 0, 0},
+    {0, 1, 0, 0},
+    {0, 0, 1, 0},
+    {0, 0, 0, 1}
+}};
+
+inline vector_float4 simd_mul(const matrix_float4x4 &m, vector_float4 v) {
+    return v.x * m.columns[0] + v.y * m.columns[1] + v.z * m.columns[2] + v.w * m.columns[3];
+}
+
+inline matrix_float4x4 simd_mul(const matrix_float4x4 &a, const matrix_float4x4 &b) {
+    return {{simd_mul(a, b.columns[0]), simd_mul(a, b.columns[1]), simd_mul(a, b.columns[2]), simd_mul(a, b.columns[3])}};
+}
+
+inline vector_float3 vector_normalize(vector_float3 v) {
+    const float length = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    return {v.x / length, v.y / length, v.z / length};
+}
+
+#endif
+
+#endif /* SIMD_H */
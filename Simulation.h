@@ -0,0 +1,273 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "linalg.h"
+#include "PlayerCamera.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+/**
+ * The DoubleBuffer class passes the latest value of a small trivially
+ * copyable type from one writer to any number of readers without locks. The
+ * writer fills the slot readers are not pointed at and then points them at
+ * it. Each slot is guarded by a sequence number, odd while it is written, so
+ * a reader that overlaps a write two values later sees the number change and
+ * reads again. Values are stored as atomic words, so no read ever races a
+ * write.
+ */
+template<typename T>
+class DoubleBuffer {
+private:
+    static_assert(std::is_trivially_copyable<T>::value, "DoubleBuffer values must be trivially copyable");
+
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    struct Slot {
+        std::atomic<uint32_t> sequence{0};
+        std::atomic<uint64_t> words[WORDS];
+    };
+
+    Slot slots_[2];
+    std::atomic<uint32_t> latest_{0};
+
+public:
+    explicit DoubleBuffer(const T &value) {
+        write(value);
+    }
+
+    DoubleBuffer(const DoubleBuffer&) = delete;
+    DoubleBuffer& operator=(const DoubleBuffer&) = delete;
+
+    /**
+     * Publishes the given value. Must only be called by one thread at a
+     * time.
+     */
+    void write(const T &value) {
+        uint64_t words[WORDS] = {};
+        std::memcpy(words, &value, sizeof(T));
+
+        const uint32_t index = latest_.load(std::memory_order_relaxed) ^ 1;
+        Slot &slot = slots_[index];
+        const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++) {
+            slot.words[i].store(words[i], std::memory_order_relaxed);
+        }
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+        latest_.store(index, std::memory_order_release);
+    }
+
+    /**
+     * Returns the last value published.
+     */
+    T read() const {
+        uint64_t words[WORDS];
+        for (;;) {
+            const Slot &slot = slots_[latest_.load(std::memory_order_acquire)];
+            const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence & 1) continue;
+            for (size_t i = 0; i < WORDS; i++) {
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == sequence) break;
+        }
+        T value;
+        std::memcpy(&value, words, sizeof(T));
+        return value;
+    }
+};
+
+/**
+ * The CameraState struct is the part of a camera the simulation moves.
+ */
+struct CameraState {
+    float x;
+    float y;
+    float z;
+    float theta;
+};
+
+/**
+ * The Simulation class moves the camera on a thread of its own at a fixed
+ * number of ticks per second, whatever the frame rate, so that a slow frame
+ * neither stretches a step nor delays input. Each tick publishes the camera
+ * before and after it through a DoubleBuffer, and the renderer draws the
+ * camera interpolated between the two for the time of the frame, one tick
+ * behind the simulation.
+ */
+class Simulation {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int TICK_RATE = 120;
+
+    /**
+     * The most ticks run back to back to catch up after the thread was held
+     * up. Beyond that the missed time is dropped.
+     */
+    static constexpr int MAX_CATCH_UP_TICKS = 8;
+
+    /**
+     * Held movement keys, as a bit set.
+     */
+    enum Input: uint8_t {
+        Forwards = 1 << 0,
+        Backwards = 1 << 1,
+        Left = 1 << 2,
+        Right = 1 << 3,
+        Up = 1 << 4,
+        Down = 1 << 5
+    };
+
+private:
+    struct State {
+        CameraState previous;
+        CameraState current;
+        int64_t time;
+        uint64_t tick;
+    };
+
+    PlayerCamera camera_;
+    uint64_t tick_ = 0;
+    std::atomic<uint8_t> input_{0};
+    std::atomic<float> rotation_{0.0f};
+    DoubleBuffer<State> state_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::thread thread_;
+
+    static constexpr Clock::duration tickDuration() {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / TICK_RATE));
+    }
+
+    static CameraState stateOf(const PlayerCamera &camera) {
+        return {camera.x(), camera.y(), camera.z(), camera.theta()};
+    }
+
+    /**
+     * Advances the camera by one tick of the held input and the rotation
+     * accumulated since the last tick, and publishes it as stamped with the
+     * given time. Called with the mutex held.
+     */
+    void step(Clock::time_point time) {
+        ScopedTrace trace("Simulation::step");
+        const CameraState previous = stateOf(camera_);
+        const float dt = 1.0f / TICK_RATE;
+        const uint8_t input = input_.load(std::memory_order_relaxed);
+        camera_.rotateTheta(rotation_.exchange(0.0f, std::memory_order_relaxed));
+        if (input & Forwards) camera_.moveForwards(dt);
+        if (input & Left) camera_.moveLeft(dt);
+        if (input & Backwards) camera_.moveBackwards(dt);
+        if (input & Right) camera_.moveRight(dt);
+        if (input & Up) camera_.moveUp(dt);
+        if (input & Down) camera_.moveDown(dt);
+        tick_++;
+        state_.write({previous, stateOf(camera_), time.time_since_epoch().count(), tick_});
+    }
+
+    void run() {
+        Tracer::global().setThreadName("simulation");
+        std::unique_lock<std::mutex> lock(mutex_);
+        Clock::time_point next = Clock::now();
+        while (!stopping_) {
+            next += tickDuration();
+            wake_.wait_until(lock, next, [this]() { return stopping_; });
+            if (stopping_) break;
+            step(next);
+            if (Clock::now() - next > MAX_CATCH_UP_TICKS * tickDuration()) next = Clock::now();
+        }
+    }
+
+public:
+
+    /**
+     * Starts simulating the given camera.
+     */
+    explicit Simulation(const PlayerCamera &camera):
+        camera_(camera), state_({stateOf(camera), stateOf(camera), Clock::now().time_since_epoch().count(), 0}) {
+        thread_ = std::thread(&Simulation::run, this);
+    }
+
+    ~Simulation() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    /**
+     * Sets whether the given movement key is held.
+     */
+    void setInput(Input input, bool held) {
+        if (held) {
+            input_.fetch_or(input, std::memory_order_relaxed);
+        } else {
+            input_.fetch_and((uint8_t) ~input, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Turns the camera by the given angle in degrees at the next tick.
+     */
+    void rotate(float dtheta) {
+        float rotation = rotation_.load(std::memory_order_relaxed);
+        while (!rotation_.compare_exchange_weak(rotation, rotation + dtheta, std::memory_order_relaxed)) {}
+    }
+
+    /**
+     * Moves the camera to the given state at once, without interpolating
+     * from where it was.
+     */
+    void reset(const CameraState &state) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        camera_ = PlayerCamera(state.x, state.y, state.z, state.theta);
+        rotation_ = 0.0f;
+        state_.write({state, state, Clock::now().time_since_epoch().count(), tick_});
+    }
+
+    /**
+     * Returns the number of ticks run so far.
+     */
+    uint64_t tick() const {
+        return state_.read().tick;
+    }
+
+    /**
+     * Returns the camera interpolated between the last two ticks for the
+     * given time, one tick after the last tick was due.
+     */
+    CameraState interpolate(Clock::time_point time) const {
+        const State state = state_.read();
+        const Clock::duration elapsed = time.time_since_epoch() - Clock::duration(state.time);
+        const float alpha = std::min(std::max((float) elapsed.count() / tickDuration().count(), 0.0f), 1.0f);
+        auto mix = [=](float a, float b) {
+            return a + (b - a) * alpha;
+        };
+        return {
+            mix(state.previous.x, state.current.x),
+            mix(state.previous.y, state.current.y),
+            mix(state.previous.z, state.current.z),
+            mix(state.previous.theta, state.current.theta)
+        };
+    }
+};
+
+#endif /* SIMULATION_H */
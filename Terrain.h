@@ -0,0 +1,264 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include "Perlin.h"
+
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+class Biome {
+public:
+    static constexpr int SEA_LEVEL = 62;
+
+    static int MountainBiomeHeight(int global_x, int global_y) {
+        return MountainBiomeHeight(perlin2d(global_x + 9134, global_y + 2514, 0.02, 3));
+    }
+
+    static int MountainBiomeHeight(float noise) {
+        return SEA_LEVEL + 20 + (int) (72.0 / (1.0 + exp(-10.0 * (noise - 0.5))));
+    }
+
+    static int SnowBiomeHeight(int global_x, int global_y) {
+        return SnowBiomeHeight(perlin2d(global_x, global_y, 0.025, 2));
+    }
+
+    static int SnowBiomeHeight(float noise) {
+        return SEA_LEVEL + 40 * (noise - 0.5);
+    }
+
+    static int GrassBiomeHeight(int global_x, int global_y) {
+        return GrassBiomeHeight(perlin2d(global_x, global_y, 0.025, 2));
+    }
+
+    static int GrassBiomeHeight(float noise) {
+        return SEA_LEVEL + 40 * (noise - 0.5);
+    }
+
+    static int SandBiomeHeight(int global_x, int global_y) {
+        return SandBiomeHeight(perlin2d(global_x, global_y, 0.015, 1));
+    }
+
+    static int SandBiomeHeight(float noise) {
+        return SEA_LEVEL + 40 * noise;
+    }
+};
+
+/**
+ * The biome selection noise, biome weights and final surface height of the
+ * terrain at one global (x, y) position.
+ */
+struct Column {
+    float noise1;
+    float noise2;
+    float mountain;
+    float snow;
+    float grass;
+    float sand;
+    int height;
+
+    /**
+     * Computes the nx by ny columns starting at global position (x0, y0) and
+     * writes the column at (x0 + i, y0 + j) to out[j * nx + i].
+     */
+    static void generate(int x0, int y0, int nx, int ny, Column *out) {
+        std::unique_ptr<double[]> grids(new double[5 * nx * ny]);
+        double *noise1_grid = &grids[0];
+        double *noise2_grid = &grids[nx * ny];
+        double *mountain_grid = &grids[2 * nx * ny];
+        double *hills_grid = &grids[3 * nx * ny];
+        double *sand_grid = &grids[4 * nx * ny];
+        perlin2d_grid(x0, y0, 1.0, nx, ny, 0.002, 3, noise1_grid);
+        perlin2d_grid(x0 + 5231, y0 + 8152, 1.0, nx, ny, 0.002, 3, noise2_grid);
+        perlin2d_grid(x0 + 9134, y0 + 2514, 1.0, nx, ny, 0.02, 3, mountain_grid);
+        perlin2d_grid(x0, y0, 1.0, nx, ny, 0.025, 2, hills_grid);
+        perlin2d_grid(x0, y0, 1.0, nx, ny, 0.015, 1, sand_grid);
+
+        for (int k = 0; k < nx * ny; k++) {
+            float noise1 = noise1_grid[k];
+            float noise2 = noise2_grid[k];
+
+            float mountain = 0.0;
+            float snow = 0.0;
+            float grass = 0.0;
+            float sand = 0.0;
+
+            if (noise1 >= 0.6 && noise2 >= 0.6) {
+                mountain = 1.0;
+            } else if (noise1 >= 0.6 && noise2 >= 0.4) {
+                mountain = std::abs(noise2 - 0.4) / 0.2;
+            } else if (noise1 >= 0.4 && noise2 >= 0.6) {
+                mountain = std::abs(noise1 - 0.4) / 0.2;
+            } else if (noise1 >= 0.4 && noise2 >= 0.4) {
+                mountain = std::abs(noise1 - 0.4) * std::abs(noise2 - 0.4) / 0.04;
+            }
+
+            if (noise1 >= 0.6 && noise2 <= 0.4) {
+                snow = 1.0;
+            } else if (noise1 >= 0.6 && noise2 <= 0.6) {
+                snow = std::abs(noise2 - 0.6) / 0.2;
+            } else if (noise1 >= 0.4 && noise2 <= 0.4) {
+                snow = std::abs(noise1 - 0.4) / 0.2;
+            } else if (noise1 >= 0.4 && noise2 <= 0.6) {
+                snow = std::abs(noise2 - 0.6) * std::abs(noise1 - 0.4) / 0.04;
+            }
+
+            if (noise1 <= 0.4 && noise2 >= 0.6) {
+                grass = 1.0;
+            } else if (noise1 <= 0.4 && noise2 >= 0.4) {
+                grass = std::abs(noise2 - 0.4) / 0.2;
+            } else if (noise1 <= 0.6 && noise2 >= 0.6) {
+                grass = std::abs(noise1 - 0.6) / 0.2;
+            } else if (noise1 <= 0.6 && noise2 >= 0.4) {
+                grass = std::abs(noise2 - 0.4) *  std::abs(noise1 - 0.6) / 0.04;
+            }
+
+            if (noise1 <= 0.4 && noise2 <= 0.4) {
+                sand = 1.0;
+            } else if (noise1 <= 0.4 && noise2 <= 0.6) {
+                sand = std::abs(noise2 - 0.6) / 0.2;
+            } else if (noise1 <= 0.6 && noise2 <= 0.4) {
+                sand = std::abs(noise1 - 0.6) / 0.2;
+            } else if (noise1 <= 0.6 && noise2 <= 0.6) {
+                sand = std::abs(noise1 - 0.6) * std::abs(noise2 - 0.6) / 0.04;
+            }
+
+            float sum = mountain + snow + grass + sand;
+            mountain /= sum;
+            snow /= sum;
+            grass /= sum;
+            sand /= sum;
+
+            int height = mountain * Biome::MountainBiomeHeight((float) mountain_grid[k])
+                       + snow * Biome::SnowBiomeHeight((float) hills_grid[k])
+                       + grass * Biome::GrassBiomeHeight((float) hills_grid[k])
+                       + sand * Biome::SandBiomeHeight((float) sand_grid[k]);
+
+            out[k] = {noise1, noise2, mountain, snow, grass, sand, height};
+        }
+    }
+};
+
+/**
+ * The ColumnCache class stores generated columns in square tiles so that
+ * neighbouring chunks, whose halos overlap, and concurrent generation jobs
+ * share the noise work. At most a fixed number of tiles are kept, evicting
+ * the least recently used. It is safe to use from multiple threads.
+ */
+class ColumnCache {
+public:
+    static constexpr int TILE_WIDTH = 32;
+
+private:
+    struct Tile {
+        Column columns[TILE_WIDTH * TILE_WIDTH];
+    };
+
+    struct Entry {
+        std::shared_ptr<const Tile> tile;
+        uint64_t last_used;
+    };
+
+    struct hash {
+        size_t operator()(const std::pair<int, int>& key) const {
+            return std::hash<uint64_t>{}((uint64_t) (uint32_t) key.first << 32 | (uint32_t) key.second);
+        }
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::pair<int, int>, Entry, hash> tiles_;
+    size_t max_tiles_;
+    uint64_t clock_ = 0;
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+
+    static int floorDiv(int a, int b) {
+        return a / b - (a % b < 0);
+    }
+
+    std::shared_ptr<const Tile> tile(int tx, int ty) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = tiles_.find({tx, ty});
+            if (it != tiles_.end()) {
+                it->second.last_used = ++clock_;
+                hits_++;
+                return it->second.tile;
+            }
+        }
+
+        // Generate without holding the lock. If another thread generated the
+        // same tile in the meantime, its copy is kept and this one dropped.
+        misses_++;
+        std::shared_ptr<Tile> tile(new Tile);
+        Column::generate(tx * TILE_WIDTH, ty * TILE_WIDTH, TILE_WIDTH, TILE_WIDTH, tile->columns);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto inserted = tiles_.emplace(std::make_pair(tx, ty), Entry{tile, ++clock_});
+        if (inserted.second && tiles_.size() > max_tiles_) {
+            auto oldest = tiles_.begin();
+            for (auto it = tiles_.begin(); it != tiles_.end(); ++it) {
+                if (it->second.last_used < oldest->second.last_used) oldest = it;
+            }
+            tiles_.erase(oldest);
+        }
+        return inserted.first->second.tile;
+    }
+
+public:
+
+    ColumnCache(size_t max_tiles = 256): max_tiles_{max_tiles} {}
+
+    /**
+     * Copies the nx by ny columns starting at global position (x0, y0) to
+     * out, with the column at (x0 + i, y0 + j) written to out[j * nx + i].
+     */
+    void getColumns(int x0, int y0, int nx, int ny, Column *out) {
+        const int tx0 = floorDiv(x0, TILE_WIDTH);
+        const int ty0 = floorDiv(y0, TILE_WIDTH);
+        const int tx1 = floorDiv(x0 + nx - 1, TILE_WIDTH);
+        const int ty1 = floorDiv(y0 + ny - 1, TILE_WIDTH);
+
+        for (int tx = tx0; tx <= tx1; tx++) {
+            for (int ty = ty0; ty <= ty1; ty++) {
+                std::shared_ptr<const Tile> t = tile(tx, ty);
+                const int i0 = std::max(x0, tx * TILE_WIDTH);
+                const int i1 = std::min(x0 + nx, (tx + 1) * TILE_WIDTH);
+                const int j0 = std::max(y0, ty * TILE_WIDTH);
+                const int j1 = std::min(y0 + ny, (ty + 1) * TILE_WIDTH);
+                for (int j = j0; j < j1; j++) {
+                    std::copy(
+                        &t->columns[(j - ty * TILE_WIDTH) * TILE_WIDTH + i0 - tx * TILE_WIDTH],
+                        &t->columns[(j - ty * TILE_WIDTH) * TILE_WIDTH + i1 - tx * TILE_WIDTH],
+                        &out[(j - y0) * nx + i0 - x0]
+                    );
+                }
+            }
+        }
+    }
+
+    size_t hits() const {
+        return hits_;
+    }
+
+    size_t misses() const {
+        return misses_;
+    }
+
+    size_t tileCount() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tiles_.size();
+    }
+
+    size_t memoryUsage() const {
+        return tileCount() * sizeof(Tile);
+    }
+};
+
+#endif /* TERRAIN_H */
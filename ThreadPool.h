@@ -0,0 +1,193 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * The ThreadPool class runs jobs on a fixed number of worker threads. Jobs
+ * are spread over one queue per worker, each ordered by priority, lowest
+ * first, and a worker takes the lowest of the queue fronts, stealing it if
+ * it is in another worker's queue. A job's priority is a function that is
+ * evaluated on submission and again whenever reprioritize is called, so that
+ * queued jobs can follow a moving camera.
+ */
+class ThreadPool {
+public:
+    using Priority = std::function<float()>;
+
+private:
+    struct Job {
+        std::function<void()> task;
+        Priority priority;
+        float key;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::vector<Job> jobs;
+    };
+
+    static bool later(const Job &a, const Job &b) {
+        return a.key > b.key;
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> active_{0};
+    std::atomic<size_t> next_{0};
+    std::atomic<bool> stopping_{false};
+
+    bool pop(Queue &queue, Job &job) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.jobs.empty()) return false;
+        std::pop_heap(queue.jobs.begin(), queue.jobs.end(), later);
+        job = std::move(queue.jobs.back());
+        queue.jobs.pop_back();
+        pending_--;
+        return true;
+    }
+
+    /**
+     * Pops the job with the lowest key of any queue, so that priority orders
+     * jobs across workers and not only within each queue. The scan starts at
+     * the worker's own queue, which wins ties. A job taken by another worker
+     * between the scan and the pop leaves the next job of the same queue.
+     */
+    bool next(size_t worker, Job &job) {
+        for (;;) {
+            Queue *best = nullptr;
+            float key = 0.0f;
+            for (size_t i = 0; i < queues_.size(); i++) {
+                Queue &queue = *queues_[(worker + i) % queues_.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (!queue.jobs.empty() && (best == nullptr || queue.jobs.front().key < key)) {
+                    best = &queue;
+                    key = queue.jobs.front().key;
+                }
+            }
+            if (best == nullptr) return false;
+            if (pop(*best, job)) return true;
+        }
+    }
+
+    void run(size_t worker) {
+        while (!stopping_) {
+            Job job;
+            if (next(worker, job)) {
+                active_++;
+                job.task();
+                active_--;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&]() { return stopping_ || pending_ > 0; });
+        }
+    }
+
+public:
+
+    /**
+     * Returns one worker per hardware thread, leaving one for the render
+     * thread.
+     */
+    static size_t defaultWorkerCount() {
+        return std::max(2u, std::thread::hardware_concurrency()) - 1;
+    }
+
+    explicit ThreadPool(size_t workers = defaultWorkerCount()) {
+        workers = std::max<size_t>(workers, 1);
+        for (size_t i = 0; i < workers; i++) {
+            queues_.emplace_back(new Queue);
+        }
+        for (size_t i = 0; i < workers; i++) {
+            workers_.emplace_back(&ThreadPool::run, this, i);
+        }
+    }
+
+    /**
+     * Stops the workers once their current jobs finish. Jobs still queued are
+     * dropped and their futures report a broken promise.
+     */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread &worker: workers_) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template<typename F>
+    std::future<typename std::result_of<F()>::type> submit(F f, Priority priority) {
+        using R = typename std::result_of<F()>::type;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+        std::future<R> future = task->get_future();
+
+        Job job = {[task]() { (*task)(); }, std::move(priority), 0.0f};
+        job.key = job.priority();
+
+        Queue &queue = *queues_[next_++ % queues_.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(std::move(job));
+            std::push_heap(queue.jobs.begin(), queue.jobs.end(), later);
+            pending_++;
+        }
+        {
+            // Wait out any worker between checking for jobs and sleeping, so
+            // that the notification cannot be lost.
+            std::lock_guard<std::mutex> lock(mutex_);
+        }
+        wake_.notify_one();
+        return future;
+    }
+
+    /**
+     * Re-evaluates the priority of every queued job.
+     */
+    void reprioritize() {
+        for (auto &queue: queues_) {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            for (Job &job: queue->jobs) {
+                job.key = job.priority();
+            }
+            std::make_heap(queue->jobs.begin(), queue->jobs.end(), later);
+        }
+    }
+
+    size_t workerCount() const {
+        return workers_.size();
+    }
+
+    /**
+     * Returns the number of jobs waiting for a worker.
+     */
+    size_t queueDepth() const {
+        return pending_;
+    }
+
+    /**
+     * Returns the number of jobs currently running.
+     */
+    size_t activeCount() const {
+        return active_;
+    }
+};
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,311 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * The Tracer class records named spans of time on every thread, such as the
+ * phases of a frame and the jobs run in the background, and exports them in
+ * the Chrome trace event format or as percentiles of each phase's duration.
+ * Each thread records into a ring buffer of its own without taking a lock,
+ * and once a ring is full its oldest spans are overwritten. While tracing is
+ * disabled a ScopedTrace costs one relaxed atomic load.
+ *
+ * There is one Tracer per process, returned by global.
+ */
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * The number of spans each thread keeps.
+     */
+    static constexpr size_t RING_CAPACITY = 1 << 14;
+
+    /**
+     * The durations in milliseconds below which the given fractions of the
+     * spans of one name fall.
+     */
+    struct PhaseStats {
+        std::string name;
+        size_t count;
+        double p50;
+        double p95;
+        double p99;
+        double max;
+    };
+
+private:
+    /**
+     * A span of time in nanoseconds since the tracer was created. The name
+     * must outlive the tracer, which string literals do.
+     */
+    struct Span {
+        const char *name;
+        uint64_t start;
+        uint64_t duration;
+    };
+
+    /**
+     * A slot of a ring, holding one span in atomic fields so that a reader
+     * copying it while the owning thread overwrites it never races.
+     */
+    struct Slot {
+        std::atomic<const char*> name{nullptr};
+        std::atomic<uint64_t> start{0};
+        std::atomic<uint64_t> duration{0};
+    };
+
+    /**
+     * The spans of one thread. Only the owning thread writes spans. It
+     * advances claimed before it starts writing a slot and head once the
+     * slot is complete, so readers copy the slots below head and then
+     * discard those that claimed shows may have been overwritten meanwhile.
+     */
+    struct Ring {
+        std::unique_ptr<Slot[]> slots{new Slot[RING_CAPACITY]};
+        std::atomic<uint64_t> claimed{0};
+        std::atomic<uint64_t> head{0};
+        int thread = 0;
+        std::string name;
+    };
+
+    struct ThreadSpan {
+        int thread;
+        Span span;
+    };
+
+    std::atomic<bool> enabled_{false};
+    std::atomic<uint64_t> since_{0};
+    const Clock::time_point epoch_ = Clock::now();
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<Ring>> rings_;
+
+    Tracer() = default;
+
+    uint64_t nanoseconds(Clock::time_point time) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time - epoch_).count();
+    }
+
+    /**
+     * Returns the ring of the calling thread, registering it on first use.
+     * The tracer shares ownership of it, so spans of threads that have
+     * exited can still be exported.
+     */
+    Ring& ring() {
+        thread_local std::shared_ptr<Ring> ring;
+        if (ring == nullptr) {
+            ring = std::make_shared<Ring>();
+            std::lock_guard<std::mutex> lock(mutex_);
+            ring->thread = (int) rings_.size() + 1;
+            ring->name = "thread " + std::to_string(ring->thread);
+            rings_.push_back(ring);
+        }
+        return *ring;
+    }
+
+    /**
+     * Returns the spans recorded since the last clear that are still held
+     * by the rings.
+     */
+    std::vector<ThreadSpan> collect() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const uint64_t since = since_;
+        std::vector<ThreadSpan> out;
+        for (const std::shared_ptr<Ring> &ring: rings_) {
+            const uint64_t head = ring->head.load(std::memory_order_acquire);
+            const uint64_t first = head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+            const size_t begin = out.size();
+            for (uint64_t i = first; i < head; i++) {
+                const Slot &slot = ring->slots[i % RING_CAPACITY];
+                out.push_back({ring->thread, {
+                    slot.name.load(std::memory_order_relaxed),
+                    slot.start.load(std::memory_order_relaxed),
+                    slot.duration.load(std::memory_order_relaxed)
+                }});
+            }
+
+            // Any write seen by the copy above was claimed before it began,
+            // and the span a claimed slot replaces is RING_CAPACITY older.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t claimed = ring->claimed.load(std::memory_order_relaxed);
+            const uint64_t overwritten = claimed > RING_CAPACITY ? claimed - RING_CAPACITY : 0;
+            if (overwritten > first) {
+                out.erase(out.begin() + begin, out.begin() + begin + std::min<uint64_t>(overwritten - first, head - first));
+            }
+        }
+        out.erase(std::remove_if(out.begin(), out.end(), [=](const ThreadSpan &s) {
+            return s.span.start < since;
+        }), out.end());
+        return out;
+    }
+
+    static void writeString(std::ostream &out, const std::string &s) {
+        out << '"';
+        for (char c: s) {
+            if (c == '"' || c == '\\') out << '\\';
+            out << c;
+        }
+        out << '"';
+    }
+
+public:
+    static Tracer& global() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    bool isEnabled() const {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool enabled) {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    /**
+     * Names the calling thread in exported traces.
+     */
+    void setThreadName(const std::string &name) {
+        Ring &r = ring();
+        std::lock_guard<std::mutex> lock(mutex_);
+        r.name = name;
+    }
+
+    /**
+     * Records a span with the given name from start to end on the calling
+     * thread, whether or not tracing is enabled.
+     */
+    void record(const char *name, Clock::time_point start, Clock::time_point end) {
+        Ring &r = ring();
+        const uint64_t head = r.head.load(std::memory_order_relaxed);
+        r.claimed.store(head + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Slot &slot = r.slots[head % RING_CAPACITY];
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.start.store(nanoseconds(start), std::memory_order_relaxed);
+        slot.duration.store(nanoseconds(end) - nanoseconds(start), std::memory_order_relaxed);
+        r.head.store(head + 1, std::memory_order_release);
+    }
+
+    /**
+     * Drops every span recorded so far from later exports and statistics.
+     */
+    void clear() {
+        since_ = nanoseconds(Clock::now());
+    }
+
+    /**
+     * Writes the recorded spans as Chrome trace event JSON, which can be
+     * opened in chrome://tracing or Perfetto.
+     */
+    void writeChromeTrace(std::ostream &out) {
+        const std::vector<ThreadSpan> spans = collect();
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const std::shared_ptr<Ring> &ring: rings_) {
+                out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->thread << ",\"args\":{\"name\":";
+                writeString(out, ring->name);
+                out << "}}";
+                first = false;
+            }
+        }
+        for (const ThreadSpan &s: spans) {
+            out << (first ? "\n" : ",\n") << "{\"name\":";
+            writeString(out, s.span.name);
+            char times[64];
+            std::snprintf(times, sizeof(times), ",\"ts\":%.3f,\"dur\":%.3f}", s.span.start / 1000.0, s.span.duration / 1000.0);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << s.thread << times;
+            first = false;
+        }
+        out << "\n]}\n";
+    }
+
+    /**
+     * Writes the Chrome trace to the file at the given path. Returns false
+     * if it could not be written.
+     */
+    bool writeChromeTrace(const std::string &path) {
+        std::ofstream out(path);
+        if (!out) return false;
+        writeChromeTrace(out);
+        return (bool) out;
+    }
+
+    /**
+     * Returns the count and duration percentiles of the recorded spans of
+     * every name, sorted by name.
+     */
+    std::vector<PhaseStats> phaseStats() {
+        std::map<std::string, std::vector<uint64_t>> durations;
+        for (const ThreadSpan &s: collect()) {
+            durations[s.span.name].push_back(s.span.duration);
+        }
+
+        std::vector<PhaseStats> stats;
+        for (auto &it: durations) {
+            std::vector<uint64_t> &d = it.second;
+            std::sort(d.begin(), d.end());
+            auto percentile = [&](double p) {
+                const size_t rank = (size_t) std::ceil(p * d.size());
+                return d[std::max<size_t>(rank, 1) - 1] / 1e6;
+            };
+            stats.push_back({it.first, d.size(), percentile(0.50), percentile(0.95), percentile(0.99), d.back() / 1e6});
+        }
+        return stats;
+    }
+
+    /**
+     * Writes phaseStats as a table.
+     */
+    void writePhaseStats(std::ostream &out) {
+        char line[160];
+        std::snprintf(line, sizeof(line), "%-40s %8s %9s %9s %9s %9s\n", "phase", "count", "p50 ms", "p95 ms", "p99 ms", "max ms");
+        out << line;
+        for (const PhaseStats &s: phaseStats()) {
+            std::snprintf(line, sizeof(line), "%-40s %8zu %9.3f %9.3f %9.3f %9.3f\n", s.name.c_str(), s.count, s.p50, s.p95, s.p99, s.max);
+            out << line;
+        }
+    }
+};
+
+/**
+ * The ScopedTrace class records a span covering its own lifetime under the
+ * given name, if tracing was enabled when it was created.
+ */
+class ScopedTrace {
+private:
+    const char *name_;
+    Tracer::Clock::time_point start_;
+
+public:
+    explicit ScopedTrace(const char *name): name_(Tracer::global().isEnabled() ? name : nullptr) {
+        if (name_ != nullptr) start_ = Tracer::Clock::now();
+    }
+
+    ~ScopedTrace() {
+        if (name_ != nullptr) Tracer::global().record(name_, start_, Tracer::Clock::now());
+    }
+
+    ScopedTrace(const ScopedTrace&) = delete;
+    ScopedTrace& operator=(const ScopedTrace&) = delete;
+};
+
+#endif /* TRACE_H */
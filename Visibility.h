@@ -0,0 +1,101 @@
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include <bitset>
+#include <cstdint>
+
+/**
+ * The SectionVisibility class records which faces of a section of a chunk can
+ * see each other through the blocks that are not opaque. The six faces are
+ * numbered like the side bits of Block: front (-y), back (+y), left (-x),
+ * right (+x), top (+z) and bottom (-z), so the opposite of a face is the face
+ * with its lowest bit flipped. A set holds one bit for each of the 15 pairs
+ * of different faces.
+ */
+class SectionVisibility {
+public:
+    static constexpr int FACE_COUNT = 6;
+
+    /**
+     * The set in which every face sees every other face, as in a section of
+     * air.
+     */
+    static constexpr uint16_t ALL = (1 << 15) - 1;
+
+    static constexpr int opposite(int face) {
+        return face ^ 1;
+    }
+
+    /**
+     * Returns the bit of the given pair of different faces.
+     */
+    static constexpr uint16_t pair(int a, int b) {
+        return a > b ? pair(b, a) : 1 << (a * (2 * FACE_COUNT - a - 1) / 2 + b - a - 1);
+    }
+
+    static constexpr bool connects(uint16_t set, int a, int b) {
+        return (set & pair(a, b)) != 0;
+    }
+
+    /**
+     * Flood fills the blocks of a section width by width by height blocks
+     * that are not opaque, and returns the set of pairs of faces touched by
+     * the same connected region. opaque(x, y, z) is called with coordinates
+     * relative to the section.
+     */
+    template<int Width, int Height, typename Opaque>
+    static uint16_t compute(Opaque opaque) {
+        constexpr int N = Width * Width * Height;
+        std::bitset<N> seen;
+        uint16_t stack[N];
+        uint16_t set = 0;
+
+        auto index = [](int x, int y, int z) {
+            return (z * Width + y) * Width + x;
+        };
+
+        for (int start = 0; start < N && set != ALL; start++) {
+            if (seen[start]) continue;
+            seen[start] = true;
+            const int sx = start % Width, sy = start / Width % Width, sz = start / (Width * Width);
+            if (opaque(sx, sy, sz)) continue;
+
+            uint8_t faces = 0;
+            int top = 0;
+            stack[top++] = start;
+            while (top > 0) {
+                const int i = stack[--top];
+                const int x = i % Width, y = i / Width % Width, z = i / (Width * Width);
+                if (y == 0) faces |= 1 << 0;
+                if (y == Width - 1) faces |= 1 << 1;
+                if (x == 0) faces |= 1 << 2;
+                if (x == Width - 1) faces |= 1 << 3;
+                if (z == Height - 1) faces |= 1 << 4;
+                if (z == 0) faces |= 1 << 5;
+
+                auto visit = [&](int nx, int ny, int nz) {
+                    const int j = index(nx, ny, nz);
+                    if (seen[j]) return;
+                    seen[j] = true;
+                    if (!opaque(nx, ny, nz)) stack[top++] = j;
+                };
+                if (y > 0) visit(x, y - 1, z);
+                if (y < Width - 1) visit(x, y + 1, z);
+                if (x > 0) visit(x - 1, y, z);
+                if (x < Width - 1) visit(x + 1, y, z);
+                if (z < Height - 1) visit(x, y, z + 1);
+                if (z > 0) visit(x, y, z - 1);
+            }
+
+            for (int a = 0; a < FACE_COUNT; a++) {
+                if (!(faces & (1 << a))) continue;
+                for (int b = a + 1; b < FACE_COUNT; b++) {
+                    if (faces & (1 << b)) set |= pair(a, b);
+                }
+            }
+        }
+        return set;
+    }
+};
+
+#endif /* VISIBILITY_H */
@@ -0,0 +1,25 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/**
+ * Replaces the global allocation functions for the benchmark so that heap
+ * allocations can be counted. They live in a translation unit of their own
+ * and are never inlined, so the compiler does not pair a new expression in
+ * the benchmark with the malloc and free that implement it.
+ */
+std::atomic<size_t> allocation_count{0};
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocation_count++;
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
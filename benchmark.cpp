@@ -0,0 +1,677 @@
+#include "GameEngine.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The Result struct is one measurement. Results are printed together once
+ * every benchmark has run, as JSON unless a table is asked for.
+ */
+struct Result {
+    std::string name;
+    double value;
+    const char *unit;
+};
+
+static std::vector<Result> results;
+
+static void report(const std::string &name, double value, const char *unit) {
+    results.push_back({name, value, unit});
+}
+
+static void printResults(bool table) {
+    if (table) {
+        for (const Result &result: results) {
+            std::printf("%-40s %14.1f %s\n", result.name.c_str(), result.value, result.unit);
+        }
+        return;
+    }
+    std::printf("{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        std::printf("    {\"name\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}%s\n",
+            results[i].name.c_str(), results[i].value, results[i].unit, i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Counts heap allocations made anywhere in the process, so that the
+ * allocations made while meshing a chunk can be read off as a difference.
+ * Defined with the replaced allocation functions in allocations.cpp.
+ */
+extern std::atomic<size_t> allocation_count;
+
+/**
+ * Returns the faces of the block at the given position that border air.
+ */
+static Block::FaceSet exposedFaces(const Chunk &chunk, int x, int y, int z) {
+    Block::FaceSet faces = 0;
+    if (chunk.getBlock(x + 1, y, z) == Block::Air) faces |= Block::Right;
+    if (chunk.getBlock(x - 1, y, z) == Block::Air) faces |= Block::Left;
+    if (chunk.getBlock(x, y + 1, z) == Block::Air) faces |= Block::Back;
+    if (chunk.getBlock(x, y - 1, z) == Block::Air) faces |= Block::Front;
+    if (z + 1 == Chunk::HEIGHT || chunk.getBlock(x, y, z + 1) == Block::Air) faces |= Block::Top;
+    if (z == 0 || chunk.getBlock(x, y, z - 1) == Block::Air) faces |= Block::Bottom;
+    return faces;
+}
+
+/**
+ * Meshes a chunk the way the renderer did before meshing used a per-thread
+ * arena: a Block is built for every solid block and appended to a growing
+ * buffer.
+ */
+static Buffer meshPerBlock(const Chunk &chunk) {
+    Buffer mesh;
+    for (int x = 0; x < Chunk::WIDTH; x++) {
+        for (int y = 0; y < Chunk::WIDTH; y++) {
+            for (int z = 0; z < Chunk::HEIGHT; z++) {
+                const uint8_t block = chunk.getBlock(x, y, z);
+                if (block == Block::Air) continue;
+                const Block::FaceSet faces = exposedFaces(chunk, x, y, z);
+                if (faces == 0) continue;
+                mesh += Block(block, faces, {x, y, z});
+            }
+        }
+    }
+    return mesh;
+}
+
+/**
+ * Expands a mesh into the vertices of its triangles, three per triangle, in
+ * the order the shared index buffer draws them.
+ */
+static std::vector<Vertex> triangles(const Buffer &mesh) {
+    std::vector<Buffer::Index> indices(mesh.size() / 4 * 6);
+    Buffer::quadIndices(mesh.size() / 4, indices.data());
+    std::vector<Vertex> vertices;
+    for (Buffer::Index i: indices) {
+        vertices.push_back(mesh.data()[i]);
+    }
+    return vertices;
+}
+
+/**
+ * Returns the triangles of every exposed block face of a chunk the way they
+ * were drawn before meshes were indexed: the corners a, b, c and d of each
+ * face, as Block::addFace lists them, expanded into the six vertices a, b, d,
+ * b, c, d. Written out here rather than through Buffer so that a change to
+ * Buffer::addQuad or Buffer::quadIndices cannot change the reference too.
+ */
+static std::vector<std::array<Vertex, 3>> referenceTriangles(const Chunk &chunk) {
+    // The corners of each face by face index, 1 selecting the upper bound of
+    // the block along an axis and 0 the lower one.
+    static const int corners[6][4][3] = {
+        {{1, 0, 0}, {0, 0, 0}, {0, 0, 1}, {1, 0, 1}},
+        {{1, 1, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}},
+        {{0, 1, 1}, {0, 0, 1}, {0, 0, 0}, {0, 1, 0}},
+        {{1, 1, 0}, {1, 0, 0}, {1, 0, 1}, {1, 1, 1}},
+        {{1, 1, 1}, {1, 0, 1}, {0, 0, 1}, {0, 1, 1}},
+        {{0, 1, 0}, {0, 0, 0}, {1, 0, 0}, {1, 1, 0}},
+    };
+    static const int order[6] = {0, 1, 3, 1, 2, 3};
+    std::vector<std::array<Vertex, 3>> sorted;
+    for (int x = 0; x < Chunk::WIDTH; x++) {
+        for (int y = 0; y < Chunk::WIDTH; y++) {
+            for (int z = 0; z < Chunk::HEIGHT; z++) {
+                const uint8_t block = chunk.getBlock(x, y, z);
+                if (block == Block::Air) continue;
+                const Block::FaceSet faces = exposedFaces(chunk, x, y, z);
+                for (uint32_t face = 0; face < 6; face++) {
+                    if (!(faces & (1 << face))) continue;
+                    const std::pair<int, int> texture = Block::getTexture(block, 1 << face);
+                    const uint32_t tile = texture.first + 16 * texture.second;
+                    Vertex vertices[6];
+                    for (int i = 0; i < 6; i++) {
+                        const int *corner = corners[face][order[i]];
+                        vertices[i] = makeVertex(x + corner[0], y + corner[1], z + corner[2], face, tile);
+                    }
+                    sorted.push_back({vertices[0], vertices[1], vertices[2]});
+                    sorted.push_back({vertices[3], vertices[4], vertices[5]});
+                }
+            }
+        }
+    }
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+/**
+ * Returns the triangles of every section of a chunk, sorted so that meshes
+ * emitting the same triangles in a different order compare equal.
+ */
+static std::vector<std::array<Vertex, 3>> sortedTriangles(const Chunk &chunk, Chunk::MeshingMode mode) {
+    std::vector<std::array<Vertex, 3>> sorted;
+    for (int section = 0; section < Chunk::SECTION_COUNT; section++) {
+        const std::vector<Vertex> vertices = triangles(chunk.mesh(mode, section));
+        for (size_t i = 0; i < vertices.size(); i += 3) {
+            sorted.push_back({vertices[i], vertices[i + 1], vertices[i + 2]});
+        }
+    }
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+/**
+ * Returns the number of vertices in the meshes of every section of a chunk.
+ */
+static size_t meshSections(const Chunk &chunk, Chunk::MeshingMode mode) {
+    size_t vertices = 0;
+    for (int section = 0; section < Chunk::SECTION_COUNT; section++) {
+        vertices += chunk.mesh(mode, section).size();
+    }
+    return vertices;
+}
+
+/**
+ * Returns the sign of the winding of the given triangle seen from outside the
+ * face it belongs to.
+ */
+static int winding(const Vertex *triangle) {
+    static const int normals[6][3] = {{0, -1, 0}, {0, 1, 0}, {-1, 0, 0}, {1, 0, 0}, {0, 0, 1}, {0, 0, -1}};
+    int p[3][3];
+    for (int i = 0; i < 3; i++) {
+        p[i][0] = (triangle[i] >> VERTEX_X_SHIFT) & 0x1f;
+        p[i][1] = (triangle[i] >> VERTEX_Y_SHIFT) & 0x1f;
+        p[i][2] = (triangle[i] >> VERTEX_Z_SHIFT) & 0x1ff;
+    }
+    const int u[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+    const int v[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+    const int n[3] = {u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]};
+    const int *normal = normals[(triangle[0] >> VERTEX_FACE_SHIFT) & 0x7];
+    const int d = n[0] * normal[0] + n[1] * normal[1] + n[2] * normal[2];
+    return (d > 0) - (d < 0);
+}
+
+/**
+ * Checks that the indexed per-block mesh and per-face section meshes draw
+ * exactly the triangles of the unindexed reference and that every triangle of
+ * both meshers is wound the same way relative to its face, so back face
+ * culling keeps the outside of every face.
+ */
+static bool verifyMeshes(const std::vector<Chunk*> &chunks) {
+    int expected = 0;
+    for (Chunk *chunk: chunks) {
+        const std::vector<std::array<Vertex, 3>> reference = referenceTriangles(*chunk);
+        const std::vector<Vertex> vertices = triangles(meshPerBlock(*chunk));
+        std::vector<std::array<Vertex, 3>> perBlock;
+        for (size_t i = 0; i < vertices.size(); i += 3) {
+            perBlock.push_back({vertices[i], vertices[i + 1], vertices[i + 2]});
+        }
+        std::sort(perBlock.begin(), perBlock.end());
+        if (perBlock != reference) return false;
+        if (sortedTriangles(*chunk, Chunk::MeshingMode::PerFace) != reference) return false;
+
+        const std::vector<std::array<Vertex, 3>> greedy = sortedTriangles(*chunk, Chunk::MeshingMode::Greedy);
+        const std::vector<std::array<Vertex, 3>> *meshes[] = {&reference, &greedy};
+        for (const std::vector<std::array<Vertex, 3>> *mesh: meshes) {
+            for (const std::array<Vertex, 3> &triangle: *mesh) {
+                const int w = winding(triangle.data());
+                if (expected == 0) expected = w;
+                if (w == 0 || w != expected) return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks that a draw list of the section meshes of the given chunks, seen
+ * from a fixed camera, draws every section that has a mesh exactly once and
+ * no other, front to back by the distance to the center of each section,
+ * binding each buffer once and setting the transform only when the chunk
+ * changes.
+ */
+static bool verifyDrawList(const std::vector<Chunk*> &chunks) {
+    struct Section {
+        simd::int3 origin;
+        size_t indexCount;
+        double distance;
+    };
+
+    const PlayerCamera camera(3.25f, -7.5f, 90.0f, 30.0f);
+    DrawList list;
+    std::map<const Vertex*, Section> expected;
+    for (Chunk *chunk: chunks) {
+        const Chunk::Location location = chunk->getLocation();
+        const simd::int3 origin = {location.first * Chunk::WIDTH, location.second * Chunk::WIDTH, 0};
+        for (int section = 0; section < Chunk::SECTION_COUNT; section++) {
+            const Buffer &mesh = chunk->mesh(Chunk::MeshingMode::PerFace, section);
+            if (mesh.size() == 0) continue;
+            NativeBuffer buffer(nullptr, mesh.size(), origin);
+            buffer.fill(mesh);
+            const float z0 = section * Chunk::SECTION_HEIGHT;
+            list.add(buffer, camera, {0, 0, z0}, {Chunk::WIDTH, Chunk::WIDTH, z0 + Chunk::SECTION_HEIGHT});
+
+            const double dx = origin[0] + Chunk::WIDTH / 2.0 - 0.5 - camera.x();
+            const double dy = origin[1] + Chunk::WIDTH / 2.0 - 0.5 - camera.y();
+            const double dz = z0 + Chunk::SECTION_HEIGHT / 2.0 - 0.5 - camera.z();
+            expected[buffer.data()] = {origin, (size_t) buffer.indexCount(), dx * dx + dy * dy + dz * dz};
+        }
+    }
+    list.sort();
+
+    RecordingBackend backend;
+    list.submit(backend, camera);
+    const std::vector<RecordingBackend::Record> &records = backend.records();
+    if (records.size() < 2 || records.front().call != RecordingBackend::Call::BeginFrame || records.back().call != RecordingBackend::Call::EndFrame) return false;
+
+    std::map<const Vertex*, Section>::const_iterator bound = expected.end();
+    const Section *previous = nullptr;
+    std::set<const Vertex*> drawn;
+    size_t transforms = 0;
+    size_t originChanges = 0;
+    for (const RecordingBackend::Record &record: records) {
+        if (record.call == RecordingBackend::Call::SetVertexBuffer) {
+            bound = expected.find(record.buffer);
+            if (bound == expected.end() || drawn.count(record.buffer)) return false;
+        } else if (record.call == RecordingBackend::Call::SetTransform) {
+            transforms++;
+        } else if (record.call == RecordingBackend::Call::DrawQuads) {
+            if (bound == expected.end() || drawn.count(bound->first) || record.value != bound->second.indexCount) return false;
+            const Section &section = bound->second;
+            if (previous != nullptr && section.distance < previous->distance * (1 - 1e-5)) return false;
+            if (previous == nullptr || previous->origin[0] != section.origin[0] || previous->origin[1] != section.origin[1]) originChanges++;
+            drawn.insert(bound->first);
+            previous = &section;
+        }
+    }
+    return drawn.size() == expected.size() && transforms == originChanges && backend.count(RecordingBackend::Call::SetFade) == 1;
+}
+
+/**
+ * Moves a chunk grid around randomly, changing its radius now and then, and
+ * checks after every move that it holds exactly the locations within the
+ * circle, each with the value loaded for it, and that every location loaded
+ * is unloaded once it leaves.
+ */
+static bool verifyChunkGrid() {
+    std::mt19937 random(3);
+    std::uniform_int_distribution<int> step(-6, 6);
+    ChunkGrid<Chunk::Location> grid;
+    std::set<Chunk::Location> loaded;
+    bool valid = true;
+    auto load = [&](Chunk::Location loc) {
+        if (!loaded.insert(loc).second) valid = false;
+        return new Chunk::Location(loc);
+    };
+    auto unload = [&](Chunk::Location *loc) {
+        if (loaded.erase(*loc) != 1) valid = false;
+        delete loc;
+    };
+
+    Chunk::Location center = {0, 0};
+    int radius = 5;
+    for (int move = 0; move < 500 && valid; move++) {
+        if (move % 50 == 0) radius = 1 + random() % 12;
+        center.first += move % 97 == 0 ? 100 : step(random);
+        center.second += step(random);
+        grid.update(center, radius, load, unload);
+
+        size_t inside = 0;
+        for (int y = center.second - radius - 2; y <= center.second + radius + 2; y++) {
+            for (int x = center.first - radius - 2; x <= center.first + radius + 2; x++) {
+                const int i = x - center.first, j = y - center.second;
+                const Chunk::Location *item = grid.get({x, y});
+                if (i * i + j * j <= radius * radius) {
+                    inside++;
+                    if (item == nullptr || *item != Chunk::Location(x, y)) valid = false;
+                } else if (item != nullptr) {
+                    valid = false;
+                }
+            }
+        }
+        if (inside != loaded.size() || inside != grid.items().size()) valid = false;
+    }
+    grid.update(center, radius + 1, [](Chunk::Location) { return (Chunk::Location*) nullptr; }, unload);
+    return valid && loaded.empty();
+}
+
+/**
+ * Applies random inserts and erases, clustered so that probe sequences
+ * collide, to a chunk map and a std::map, and checks that lookups, sizes and
+ * iteration agree after every operation.
+ */
+static bool verifyChunkMap() {
+    std::mt19937 random(4);
+    std::uniform_int_distribution<int> coordinate(-40, 40);
+    ChunkMap<int> map;
+    std::map<Chunk::Location, int> reference;
+    for (int op = 0; op < 200000; op++) {
+        const Chunk::Location loc = {coordinate(random), coordinate(random)};
+        if (random() % 3 == 0) {
+            if (map.erase(loc) != (reference.erase(loc) == 1)) return false;
+        } else {
+            const int value = op;
+            map.insert(loc, std::unique_ptr<int>(new int(value)));
+            reference.emplace(loc, value);
+        }
+        const int *found = map.get(loc);
+        const auto it = reference.find(loc);
+        if ((found == nullptr) != (it == reference.end()) || (found != nullptr && *found != it->second)) return false;
+        if (map.size() != reference.size()) return false;
+    }
+
+    size_t visited = 0;
+    for (auto entry: map) {
+        const auto it = reference.find(entry.first);
+        if (it == reference.end() || it->second != entry.second) return false;
+        visited++;
+    }
+    return visited == reference.size();
+}
+
+/**
+ * Makes random edits to a square of generated chunks, most of them on the
+ * edges between chunks, and checks that every edit reads back and that the
+ * halo of each chunk matches the blocks of its neighbours afterwards.
+ */
+static bool verifyEdits() {
+    World world(1);
+    for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+            world.getChunk({x, y});
+        }
+    }
+    for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+            Chunk *chunk = world.getChunk({x, y});
+            while (!chunk->isGenerated()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::mt19937 random(5);
+    std::uniform_int_distribution<int> edge(-2, 1);
+    std::uniform_int_distribution<int> anywhere(-Chunk::WIDTH, 2 * Chunk::WIDTH - 1);
+    std::uniform_int_distribution<int> height(0, Chunk::HEIGHT - 1);
+    std::vector<World::BlockEdit> edits;
+    for (int i = 0; i < 4000; i++) {
+        const int x = random() % 2 ? edge(random) + Chunk::WIDTH * (int) (random() % 2) : anywhere(random);
+        const int y = random() % 2 ? edge(random) + Chunk::WIDTH * (int) (random() % 2) : anywhere(random);
+        edits.push_back({x, y, height(random), random() % 2 ? (uint8_t) Block::Air : (uint8_t) Block::Stone});
+    }
+    world.setBlocks(edits);
+    world.applyEdits();
+
+    std::map<std::array<int, 3>, uint8_t> last;
+    for (const World::BlockEdit &edit: edits) {
+        last[{edit.x, edit.y, edit.z}] = edit.block;
+    }
+    for (const auto &it: last) {
+        if (world.getBlock(it.first[0], it.first[1], it.first[2]) != it.second) return false;
+    }
+
+    for (int a = -1; a <= 1; a++) {
+        for (int b = -1; b <= 1; b++) {
+            const Chunk *chunk = world.getChunk({a, b});
+            if (chunk->hasEdits()) return false;
+            for (int x = -1; x <= Chunk::WIDTH; x++) {
+                for (int y = -1; y <= Chunk::WIDTH; y++) {
+                    if (x >= 0 && x < Chunk::WIDTH && y >= 0 && y < Chunk::WIDTH) continue;
+                    const int wx = a * Chunk::WIDTH + x, wy = b * Chunk::WIDTH + y;
+                    if (wx < -Chunk::WIDTH || wx >= 2 * Chunk::WIDTH || wy < -Chunk::WIDTH || wy >= 2 * Chunk::WIDTH) continue;
+                    for (int z = 0; z < Chunk::HEIGHT; z++) {
+                        if (chunk->getBlock(x, y, z) != world.getBlock(wx, wy, z)) return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Runs every check, reporting each that fails.
+ */
+static bool verify(const std::vector<Chunk*> &chunks) {
+    struct Check {
+        const char *failure;
+        bool passed;
+    };
+    const Check checks[] = {
+        {"indexed meshes do not match the unindexed reference triangles", verifyMeshes(chunks)},
+        {"draw list does not match the sections in distance order", verifyDrawList(chunks)},
+        {"chunk grid does not hold the locations within its circle", verifyChunkGrid()},
+        {"chunk map does not match std::map", verifyChunkMap()},
+        {"edited blocks or halos do not match", verifyEdits()},
+    };
+    bool passed = true;
+    for (const Check &check: checks) {
+        if (!check.passed) std::fprintf(stderr, "%s\n", check.failure);
+        passed = passed && check.passed;
+    }
+    return passed;
+}
+
+template<typename F>
+static void run(const char *name, const std::vector<Chunk*> &chunks, int passes, F mesh) {
+    size_t vertices = 0;
+    const size_t allocations = allocation_count;
+    const auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+        for (Chunk *chunk: chunks) {
+            vertices += mesh(*chunk);
+        }
+    }
+    const double seconds = secondsSince(start);
+    const double meshed = (double) chunks.size() * passes;
+    report(std::string(name) + ".allocations", (allocation_count - allocations) / meshed, "allocations/chunk");
+    report(std::string(name) + ".throughput", meshed / seconds, "chunks/s");
+    if (vertices > 0) report(std::string(name) + ".vertices", vertices / meshed, "vertices/chunk");
+}
+
+/**
+ * The hash World used for its chunk map before ChunkMap, kept to compare
+ * lookups against.
+ */
+struct XorHash {
+    size_t operator()(const Chunk::Location& loc) const {
+        return std::hash<int>{}(loc.first) ^ std::hash<int>{}(loc.second);
+    }
+};
+
+/**
+ * Times hits and misses in a map holding every location in a square around
+ * the origin with the given number of chunks.
+ */
+template<typename Insert, typename Find>
+static void lookups(const char *name, size_t resident, Insert insert, Find find) {
+    const int side = (int) std::sqrt((double) resident);
+    for (int x = -side / 2; x < side - side / 2; x++) {
+        for (int y = -side / 2; y < side - side / 2; y++) {
+            insert(Chunk::Location(x, y));
+        }
+    }
+
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> coordinate(-side, side);
+    std::vector<Chunk::Location> queries(1 << 20);
+    for (Chunk::Location &loc: queries) {
+        loc = {coordinate(random), coordinate(random)};
+    }
+
+    size_t found = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (const Chunk::Location &loc: queries) {
+        found += find(loc);
+    }
+    const double seconds = secondsSince(start);
+    report(std::string(name) + "." + std::to_string(side * side), seconds * 1e9 / queries.size(), "ns/lookup");
+    report(std::string(name) + "." + std::to_string(side * side) + ".hits", 100.0 * found / queries.size(), "%");
+}
+
+/**
+ * Times perlin2d one sample at a time and perlin2d_grid over the same fixed
+ * square of coordinates. The sum of the samples is reported so the work
+ * cannot be optimized away and changes in the noise show up as well.
+ */
+static void noise(int side) {
+    std::vector<double> samples(side * side);
+    double sum = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (int y = 0; y < side; y++) {
+        for (int x = 0; x < side; x++) {
+            sum += perlin2d(x + 9134, y + 2514, 0.02, 3);
+        }
+    }
+    report("perlin2d.throughput", samples.size() / secondsSince(start), "samples/s");
+    report("perlin2d.checksum", sum, "");
+
+    start = std::chrono::steady_clock::now();
+    perlin2d_grid(9134, 2514, 1.0, side, side, 0.02, 3, samples.data());
+    report("perlin2d_grid.throughput", samples.size() / secondsSince(start), "samples/s");
+}
+
+/**
+ * Times World::getChunk for random locations within render distance, which
+ * are answered by the render distance grid, and for locations loaded once
+ * but no longer within it, which fall back to the chunk map. The lookups do
+ * not wait for the chunks to be generated.
+ */
+static void worldLookups(int d) {
+    World world(1);
+    const int far = 4 * d;
+    for (int x = -far; x <= far; x++) {
+        for (int y = -far; y <= far; y++) {
+            world.getChunk({x, y});
+        }
+    }
+    world.getChunksWithinRenderDistance(d);
+
+    std::mt19937 random(2);
+    std::uniform_int_distribution<int> near(-d / 2, d / 2);
+    std::uniform_int_distribution<int> outside(d + 1, far);
+    std::vector<Chunk::Location> grid(1 << 20);
+    std::vector<Chunk::Location> map(1 << 20);
+    for (size_t i = 0; i < grid.size(); i++) {
+        grid[i] = {near(random), near(random)};
+        map[i] = {outside(random), -outside(random)};
+    }
+
+    const std::vector<Chunk::Location> *queries[] = {&grid, &map};
+    const char *names[] = {"World.getChunk.grid", "World.getChunk.map"};
+    for (int i = 0; i < 2; i++) {
+        size_t found = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (const Chunk::Location &loc: *queries[i]) {
+            found += world.getChunk(loc) != nullptr;
+        }
+        report(names[i], secondsSince(start) * 1e9 / queries[i]->size(), "ns/lookup");
+        if (found != queries[i]->size()) std::fprintf(stderr, "%s missed chunks\n", names[i]);
+    }
+}
+
+/**
+ * Times the noise, then generates a square of chunks, runs the checks of
+ * verify and meshes every chunk with the old per-block path and with both
+ * arena meshers, measuring the heap allocations made per chunk and the
+ * meshing throughput. Arena meshing is measured after a warm up pass, since
+ * the arena is allocated by the first mesh on a thread. Generating a chunk
+ * from empty caches is then compared with loading its stored blocks, and
+ * chunk map and World lookups are timed last. Every seed and coordinate is
+ * fixed, so runs are comparable. Results are printed as JSON, or as a table
+ * with --table.
+ *
+ * usage: benchmark [radius] [passes] [--table]
+ */
+int main(int argc, const char *argv[]) {
+    bool table = false;
+    std::vector<int> arguments;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--table") == 0) {
+            table = true;
+        } else {
+            arguments.push_back(std::atoi(argv[i]));
+        }
+    }
+    const int radius = arguments.size() > 0 ? arguments[0] : 4;
+    const int passes = arguments.size() > 1 ? arguments[1] : 4;
+
+    noise(512);
+
+    ColumnCache cache;
+    std::vector<Chunk*> chunks;
+    for (int x = -radius; x <= radius; x++) {
+        for (int y = -radius; y <= radius; y++) {
+            Chunk *chunk = new Chunk({x, y});
+            chunk->generate(cache);
+            chunks.push_back(chunk);
+        }
+    }
+
+    for (Chunk *chunk: chunks) {
+        meshSections(*chunk, Chunk::MeshingMode::PerFace);
+    }
+
+    if (!verify(chunks)) return 1;
+
+    report("chunks", chunks.size(), "chunks");
+    report("passes", passes, "passes");
+    run("per-block", chunks, passes, [](const Chunk &chunk) {
+        return meshPerBlock(chunk).size();
+    });
+    run("per-face", chunks, passes, [](const Chunk &chunk) {
+        return meshSections(chunk, Chunk::MeshingMode::PerFace);
+    });
+    run("greedy", chunks, passes, [](const Chunk &chunk) {
+        return meshSections(chunk, Chunk::MeshingMode::Greedy);
+    });
+
+    std::vector<std::vector<uint8_t>> stored(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i++) {
+        chunks[i]->serialize(stored[i]);
+    }
+    size_t index = 0;
+    ColumnCache columns;
+    run("generate", chunks, 1, [&](const Chunk &chunk) {
+        Chunk generated(chunk.getLocation());
+        generated.generate(columns);
+        return 0;
+    });
+    run("load", chunks, passes, [&](const Chunk &chunk) {
+        Chunk loaded(chunk.getLocation());
+        loaded.load(stored[index].data(), stored[index].size());
+        index = (index + 1) % stored.size();
+        return 0;
+    });
+
+    for (Chunk *chunk: chunks) {
+        delete chunk;
+    }
+
+    for (size_t resident: {10000, 30000, 100000}) {
+        std::unordered_map<Chunk::Location, int, XorHash> unordered;
+        lookups("unordered_map", resident, [&](Chunk::Location loc) {
+            unordered.emplace(loc, 0);
+        }, [&](Chunk::Location loc) {
+            return unordered.find(loc) != unordered.end();
+        });
+
+        ChunkMap<int> flat;
+        lookups("ChunkMap", resident, [&](Chunk::Location loc) {
+            flat.insert(loc, std::unique_ptr<int>(new int(0)));
+        }, [&](Chunk::Location loc) {
+            return flat.get(loc) != nullptr;
+        });
+    }
+
+    worldLookups(8);
+
+    printResults(table);
+    return 0;
+}
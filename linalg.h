@@ -1,18 +1,21 @@
 #ifndef LINALG_H
 #define LINALG_H
 
-#include <simd/simd.h>
+#include "Simd.h"
+
+#include <cmath>
 
 matrix_float4x4  matrix_make_rows(
                                    float m00, float m10, float m20, float m30,
                                    float m01, float m11, float m21, float m31,
                                    float m02, float m12, float m22, float m32,
                                    float m03, float m13, float m23, float m33) {
-    return (matrix_float4x4){ {
-        { m00, m01, m02, m03 },     // each line here provides column data
-        { m10, m11, m12, m13 },
-        { m20, m21, m22, m23 },
-        { m30, m31, m32, m33 } } };
+    matrix_float4x4 m;
+    m.columns[0] = vector_float4{ m00, m01, m02, m03 };     // each line here provides column data
+    m.columns[1] = vector_float4{ m10, m11, m12, m13 };
+    m.columns[2] = vector_float4{ m20, m21, m22, m23 };
+    m.columns[3] = vector_float4{ m30, m31, m32, m33 };
+    return m;
 }
 
 matrix_float4x4 matrix4x4_scale(float sx, float sy, float sz) {
@@ -36,43 +39,41 @@ matrix_float4x4 matrix_projection(float fovyRadians, float aspect, float nearZ,
 static matrix_float4x4 matrix_from_translation(float x, float y, float z)
 {
     matrix_float4x4 m = matrix_identity_float4x4;
-    m.columns[3] = (vector_float4) { x, y, z, 1.0 };
+    m.columns[3] = vector_float4{ x, y, z, 1.0f };
     return m;
 }
 
 
 static matrix_float4x4 matrix_from_rotation(float radians, float x, float y, float z)
 {
-    vector_float3 v = vector_normalize(((vector_float3){x, y, z}));
+    vector_float3 v = vector_normalize(vector_float3{x, y, z});
     float cos = cosf(radians);
     float cosp = 1.0f - cos;
     float sin = sinf(radians);
     
-    matrix_float4x4 m = {
-        .columns[0] = {
-            cos + cosp * v.x * v.x,
-            cosp * v.x * v.y + v.z * sin,
-            cosp * v.x * v.z - v.y * sin,
-            0.0f,
-        },
-        
-        .columns[1] = {
-            cosp * v.x * v.y - v.z * sin,
-            cos + cosp * v.y * v.y,
-            cosp * v.y * v.z + v.x * sin,
-            0.0f,
-        },
-        
-        .columns[2] = {
-            cosp * v.x * v.z + v.y * sin,
-            cosp * v.y * v.z - v.x * sin,
-            cos + cosp * v.z * v.z,
-            0.0f,
-        },
-        
-        .columns[3] = { 0.0f, 0.0f, 0.0f, 1.0f
-        }
+    matrix_float4x4 m;
+    m.columns[0] = vector_float4{
+        cos + cosp * v.x * v.x,
+        cosp * v.x * v.y + v.z * sin,
+        cosp * v.x * v.z - v.y * sin,
+        0.0f,
+    };
+
+    m.columns[1] = vector_float4{
+        cosp * v.x * v.y - v.z * sin,
+        cos + cosp * v.y * v.y,
+        cosp * v.y * v.z + v.x * sin,
+        0.0f,
     };
+
+    m.columns[2] = vector_float4{
+        cosp * v.x * v.z + v.y * sin,
+        cosp * v.y * v.z - v.x * sin,
+        cos + cosp * v.z * v.z,
+        0.0f,
+    };
+
+    m.columns[3] = vector_float4{ 0.0f, 0.0f, 0.0f, 1.0f };
     return m;
 }
 
@@ -10,6 +10,7 @@
 #include <cairo/cairo.h>
 #include <cairo/cairo-quartz.h>
 #include <pango/pangocairo.h>
+#include <sstream>
 
 #include "gui.h"
 
@@ -113,9 +114,93 @@ CVReturn MyDisplayLinkCallback(CVDisplayLinkRef displayLink, const CVTimeStamp*
     return kCVReturnSuccess;
 }
 
+/**
+ * The MetalBackend class issues a frame's draw list to a Metal render command
+ * encoder. The state shared by every draw is bound once when the frame begins.
+ */
+class MetalBackend: public RenderBackend {
+public:
+    MTKView *view = nil;
+    id<MTLCommandQueue> commandQueue = nil;
+    id<MTLRenderPipelineState> pipelineState = nil;
+    id<MTLDepthStencilState> depthState = nil;
+    id<MTLTexture> texture = nil;
+    id<MTLBuffer> indices = nil;
+    simd::uint2 viewportSize = {0, 0};
+
+private:
+    id<MTLCommandBuffer> commandBuffer_ = nil;
+    id<MTLRenderCommandEncoder> renderEncoder_ = nil;
+
+public:
+
+    void beginFrame(const matrix_float4x4 &camera) override {
+        commandBuffer_ = [commandQueue commandBuffer];
+        MTLRenderPassDescriptor *renderPassDescriptor = view.currentRenderPassDescriptor;
+        if (renderPassDescriptor == nil) return;
+
+        renderEncoder_ = [commandBuffer_ renderCommandEncoderWithDescriptor:renderPassDescriptor];
+        [renderEncoder_ setViewport:(MTLViewport){0.0, 0.0, (double) viewportSize.x, (double) viewportSize.y, 0.0, 1.0 }];
+        [renderEncoder_ setRenderPipelineState: pipelineState];
+        [renderEncoder_ setCullMode: MTLCullModeBack];
+        [renderEncoder_ setFragmentTexture:texture atIndex:0];
+        [renderEncoder_ setDepthStencilState: depthState];
+        [renderEncoder_
+            setVertexBytes:&camera
+            length:sizeof(matrix_float4x4)
+            atIndex: 3
+        ];
+    }
+
+    void setVertexBuffer(const NativeBuffer &buffer, size_t offset) override {
+        [renderEncoder_
+            setVertexBuffer: buffer.data()
+            offset: offset * sizeof(Vertex)
+            atIndex: 0
+        ];
+    }
+
+    void setTransform(const matrix_float4x4 &mvp) override {
+        [renderEncoder_
+            setVertexBytes:&mvp
+            length:sizeof(matrix_float4x4)
+            atIndex: 2
+        ];
+    }
+
+    void setFade(float seconds) override {
+        [renderEncoder_
+            setVertexBytes:&seconds
+            length:sizeof(float)
+            atIndex: 4
+        ];
+    }
+
+    void drawQuads(size_t indexCount) override {
+        [renderEncoder_
+            drawIndexedPrimitives: MTLPrimitiveTypeTriangle
+            indexCount: indexCount
+            indexType: MTLIndexTypeUInt16
+            indexBuffer: indices
+            indexBufferOffset: 0
+        ];
+    }
+
+    void endFrame() override {
+        if (renderEncoder_ != nil) {
+            [renderEncoder_ endEncoding];
+            [commandBuffer_ presentDrawable:view.currentDrawable];
+        }
+        [commandBuffer_ commit];
+        renderEncoder_ = nil;
+        commandBuffer_ = nil;
+    }
+};
+
 @interface Renderer: NSResponder <MTKViewDelegate> {
 @public 
     GameEngine gameEngine;
+    MetalBackend backend;
 }
 
 @property (nonatomic, strong) MTKView *view;
@@ -124,6 +209,7 @@ CVReturn MyDisplayLinkCallback(CVDisplayLinkRef displayLink, const CVTimeStamp*
 @property (nonatomic, strong) id<MTLCommandQueue> commandQueue;
 @property (nonatomic, strong) id<MTLTexture> texture;
 @property (nonatomic, strong) TestView *overlay;
+@property (nonatomic, strong) NSURL *traceURL;
 
 @property (nonatomic) simd::uint2 viewportSize;
 @property (nonatomic) unsigned long tick;
@@ -131,6 +217,7 @@ CVReturn MyDisplayLinkCallback(CVDisplayLinkRef displayLink, const CVTimeStamp*
 - (instancetype) initWithView: (MTKView *) view device: (id<MTLDevice>) device;
 - (void) mtkView: (MTKView *) view drawableSizeWillChange: (CGSize) size;
 - (void) drawInMTKView: (MTKView *) view;
+- (void) toggleTrace;
 
 @end
 
@@ -198,10 +285,25 @@ id<MTLDepthStencilState> _depthState;
         _depthState = [_device newDepthStencilStateWithDescriptor:depthDescriptor];
         
         _commandQueue = [_device newCommandQueue];
+
+        NSURL *support = [[NSFileManager defaultManager] URLForDirectory: NSApplicationSupportDirectory
+            inDomain: NSUserDomainMask appropriateForURL: nil create: YES error: nil];
+        NSURL *world = [[support URLByAppendingPathComponent: @"Terrain"] URLByAppendingPathComponent: @"world"];
+        [[NSFileManager defaultManager] createDirectoryAtURL: world withIntermediateDirectories: YES attributes: nil error: nil];
+        gameEngine.setStorage(world.fileSystemRepresentation);
+        self.traceURL = [[support URLByAppendingPathComponent: @"Terrain"] URLByAppendingPathComponent: @"trace.json"];
+        Tracer::global().setThreadName("main");
+
+        [[NSNotificationCenter defaultCenter] addObserver: self selector: @selector(applicationWillTerminate:)
+            name: NSApplicationWillTerminateNotification object: nil];
     }
     return self;
 }
 
+- (void)applicationWillTerminate:(NSNotification *)notification {
+    gameEngine.save();
+}
+
 - (void) mtkView: (MTKView *) view drawableSizeWillChange: (CGSize) size {
     _viewportSize.x = size.width;
     _viewportSize.y = size.height;
@@ -210,77 +312,41 @@ id<MTLDepthStencilState> _depthState;
 
 
 - (void)mouseMoved:(NSEvent *)theEvent {
-    self->gameEngine.playerCamera().rotateTheta(theEvent.deltaX);
+    self->gameEngine.rotateCamera(theEvent.deltaX);
+}
+
+/**
+ * Starts tracing, or stops it and writes the trace and the percentiles of
+ * each phase.
+ */
+- (void) toggleTrace {
+    Tracer &tracer = Tracer::global();
+    if (!tracer.isEnabled()) {
+        tracer.clear();
+        tracer.setEnabled(true);
+        return;
+    }
+    tracer.setEnabled(false);
+    tracer.writeChromeTrace(std::string(self.traceURL.fileSystemRepresentation));
+    std::ostringstream stats;
+    tracer.writePhaseStats(stats);
+    NSLog(@"Wrote %@\n%s", self.traceURL.path, stats.str().c_str());
 }
 
 - (void)drawInMTKView: (MTKView *) view {
+    ScopedTrace trace("drawInMTKView");
 
     self->gameEngine.setDevice(_device);
-    self->gameEngine.setDrawFunction([=](const std::vector<NativeBuffer> &buffers) {
-        self.tick += 1;
-        id<MTLCommandBuffer> commandBuffer = [_commandQueue commandBuffer];
-        MTLRenderPassDescriptor *renderPassDescriptor = view.currentRenderPassDescriptor;
-
-        float aspect = _viewportSize.x / _viewportSize.y;
-        float fov = (2 * M_PI) / 5;
-        float near = 0.01;
-        float far = 1000;
-
-        matrix_float4x4 cameraPerspective = matrix_projection(fov, aspect, near, far);
-        matrix_float4x4 cameraTranslation = matrix_from_translation(-self->gameEngine.playerCamera().x(), -self->gameEngine.playerCamera().z(), -self->gameEngine.playerCamera().y());
-        matrix_float4x4 cameraRotation = matrix_from_rotation(-self->gameEngine.playerCamera().theta() * M_PI / 180, 0, 1, 0);
-        matrix_float4x4 camera;
-
-        camera = simd_mul(cameraRotation, cameraTranslation);
-        camera = simd_mul(cameraPerspective, camera);
-
-        matrix_float4x4 mvpMatrix = matrix_from_translation(0, 0, 0);
-
-        if(renderPassDescriptor != nil) {
-            
-            id<MTLRenderCommandEncoder> renderEncoder = [commandBuffer renderCommandEncoderWithDescriptor:renderPassDescriptor];
-
-            for (const NativeBuffer &buffer: buffers) {
-                [renderEncoder setViewport:(MTLViewport){0.0, 0.0, (double) _viewportSize.x, (double) _viewportSize.y, 0.0, 1.0 }];
-                [renderEncoder setRenderPipelineState: _pipelineState];
-                [renderEncoder setCullMode: MTLCullModeBack];
-                [renderEncoder setFragmentTexture:_texture atIndex:0];
-                [renderEncoder setDepthStencilState: _depthState];
-
-                [renderEncoder 
-                    setVertexBuffer: buffer.data()
-                    offset: 0
-                    atIndex: 0
-                ];
-                
-                [renderEncoder
-                    setVertexBytes:&mvpMatrix
-                    length:sizeof(matrix_float4x4)
-                    atIndex: 2
-                ];
-
-                [renderEncoder
-                    setVertexBytes:&camera
-                    length:sizeof(matrix_float4x4)
-                    atIndex: 3
-                ];
-
-                float f = buffer.secondsSinceFirstLoaded();
-                [renderEncoder
-                    setVertexBytes:&f
-                    length:sizeof(float)
-                    atIndex: 4
-                ];
-
-                [renderEncoder drawPrimitives: MTLPrimitiveTypeTriangle vertexStart:0 vertexCount: buffer.size()];
-                
-            }
-            
-            [renderEncoder endEncoding];
-            [commandBuffer presentDrawable:view.currentDrawable];
-        }
-        [commandBuffer commit];
-    });
+    self->gameEngine.playerCamera().setAspect((float) _viewportSize.x / _viewportSize.y);
+    self.tick += 1;
+    backend.view = view;
+    backend.commandQueue = _commandQueue;
+    backend.pipelineState = _pipelineState;
+    backend.depthState = _depthState;
+    backend.texture = _texture;
+    backend.indices = self->gameEngine.indexBuffer().data();
+    backend.viewportSize = _viewportSize;
+    self->gameEngine.setBackend(&backend);
 
     gameEngine.render();  
 }
@@ -307,6 +373,10 @@ id<MTLDepthStencilState> _depthState;
 
 - (void) keyDown:(NSEvent *)theEvent {
     NSString *characters = [theEvent characters];
+    if ([characters characterAtIndex:0] == 't') {
+        [self.renderer toggleTrace];
+        return;
+    }
     if (!self.renderer->gameEngine.onKeyPress([characters characterAtIndex:0])) {
         [super keyDown:theEvent];
     }
@@ -0,0 +1,133 @@
+#include "GameEngine.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static void usage() {
+    std::fprintf(stderr,
+        "usage: pregen <directory> [--radius r | --rect x0 y0 x1 y1] [--center x y]\n"
+        "              [--threads n] [--mode greedy|per-face]\n"
+        "\n"
+        "Generates and meshes the chunks within r chunks of the center, or in the\n"
+        "rectangle of chunk locations from (x0, y0) to (x1, y1) inclusive, and\n"
+        "stores them in the world directory, which is created if missing. Chunks\n"
+        "already stored are skipped. Exits with 1 if any chunk cannot be written.\n");
+}
+
+/**
+ * Appends the locations of the rectangle from (x0, y0) to (x1, y1) that pass
+ * the given filter, one region at a time, so that chunks generated together
+ * share cached columns and are written to the same region file.
+ */
+template<typename Filter>
+static void addLocations(int x0, int y0, int x1, int y1, Filter filter, std::vector<Chunk::Location> &out) {
+    const int w = RegionFile::WIDTH;
+    for (int ry = y0 - ((y0 % w) + w) % w; ry <= y1; ry += w) {
+        for (int rx = x0 - ((x0 % w) + w) % w; rx <= x1; rx += w) {
+            for (int y = std::max(ry, y0); y <= std::min(ry + w - 1, y1); y++) {
+                for (int x = std::max(rx, x0); x <= std::min(rx + w - 1, x1); x++) {
+                    if (filter(x, y)) out.push_back({x, y});
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Pregenerates an area of the world without a window or GPU, on every core
+ * unless told otherwise, and reports the throughput and the time spent in
+ * each stage.
+ */
+int main(int argc, const char *argv[]) {
+    if (argc < 2 || argv[1][0] == '-') {
+        usage();
+        return 1;
+    }
+    const std::string directory = argv[1];
+
+    int radius = 8;
+    bool rect = false;
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    int cx = 0, cy = 0;
+    size_t threads = ThreadPool::defaultWorkerCount() + 1;
+    Chunk::MeshingMode mode = Chunk::MeshingMode::Greedy;
+
+    for (int i = 2; i < argc; i++) {
+        auto remaining = [&](int n) {
+            return i + n < argc;
+        };
+        if (std::strcmp(argv[i], "--radius") == 0 && remaining(1)) {
+            radius = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--rect") == 0 && remaining(4)) {
+            rect = true;
+            x0 = std::atoi(argv[++i]);
+            y0 = std::atoi(argv[++i]);
+            x1 = std::atoi(argv[++i]);
+            y1 = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--center") == 0 && remaining(2)) {
+            cx = std::atoi(argv[++i]);
+            cy = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--threads") == 0 && remaining(1)) {
+            threads = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--mode") == 0 && remaining(1)) {
+            const char *name = argv[++i];
+            if (std::strcmp(name, "greedy") == 0) {
+                mode = Chunk::MeshingMode::Greedy;
+            } else if (std::strcmp(name, "per-face") == 0) {
+                mode = Chunk::MeshingMode::PerFace;
+            } else {
+                usage();
+                return 1;
+            }
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    std::vector<Chunk::Location> locations;
+    if (rect) {
+        addLocations(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1), std::max(y0, y1), [](int, int) {
+            return true;
+        }, locations);
+    } else {
+        addLocations(cx - radius, cy - radius, cx + radius, cy + radius, [=](int x, int y) {
+            return (x - cx) * (x - cx) + (y - cy) * (y - cy) <= radius * radius;
+        }, locations);
+    }
+
+    World world(threads);
+    if (!world.setStorage(directory)) {
+        std::fprintf(stderr, "pregen: cannot create directory %s\n", directory.c_str());
+        return 1;
+    }
+
+    double reported = 0.0;
+    const World::PregenerationStats stats = world.pregenerate(locations, mode, [&](const World::PregenerationStats &stats) {
+        if (stats.seconds - reported < 1.0) return;
+        reported = stats.seconds;
+        std::fprintf(stderr, "%zu/%zu chunks, %.0f chunks/s\n",
+            stats.chunks + stats.skipped + stats.failed, locations.size(), stats.chunks / stats.seconds);
+    });
+
+    const double chunks = std::max<size_t>(stats.chunks, 1);
+    std::printf("threads       %zu\n", world.threadPool().workerCount());
+    std::printf("chunks        %zu generated, %zu skipped, %zu failed\n", stats.chunks, stats.skipped, stats.failed);
+    std::printf("wall time     %.3f s\n", stats.seconds);
+    std::printf("throughput    %.1f chunks/s\n", stats.chunks / std::max(stats.seconds, 1e-9));
+    std::printf("generate      %.3f ms/chunk\n", stats.generateSeconds * 1e3 / chunks);
+    std::printf("mesh          %.3f ms/chunk\n", stats.meshSeconds * 1e3 / chunks);
+    std::printf("serialize     %.3f ms/chunk\n", stats.serializeSeconds * 1e3 / chunks);
+    std::printf("write         %.3f ms/chunk\n", stats.writeSeconds * 1e3 / chunks);
+    std::printf("vertices      %.0f /chunk\n", stats.vertices / chunks);
+    std::printf("stored        %.0f bytes/chunk\n", stats.bytes / chunks);
+    std::printf("mesh cache    %.1f%% hits\n", world.meshCache()->hitRate() * 100);
+    if (stats.failed > 0) {
+        std::fprintf(stderr, "pregen: %zu chunks could not be written to %s\n", stats.failed, directory.c_str());
+        return 1;
+    }
+    return 0;
+}